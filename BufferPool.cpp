@@ -0,0 +1,89 @@
+// Nicholas McCarty
+// Copyright 2024 @ nicholasmccarty252@gmail.com
+
+#include <new>
+#include "BufferPool.h"
+
+BufferPool::BufferPool() : maxCachedBytes(size_t(1) << 30) {
+}
+
+BufferPool& BufferPool::instance() {
+    // Intentionally leaked so that buffers released by other static
+    // objects during shutdown still find a valid pool.
+    static BufferPool* const pool = new BufferPool();
+    return *pool;
+}
+
+size_t BufferPool::sizeClass(size_t bytes) {
+    // Use 8 classes per power of two: round up to a multiple of 1/8 of
+    // the largest power of two not exceeding bytes.
+    size_t step = 1;
+    while ((step << 4) <= bytes) {
+        step <<= 1;
+    }
+    return (bytes + step - 1) & ~(step - 1);
+}
+
+void* BufferPool::allocate(size_t bytes, bool reuse) {
+    if (bytes < MinPooledBytes) {
+        return ::operator new(bytes);
+    }
+    // Fresh blocks are always of the full size class, so that any block
+    // can later be pooled regardless of how it was allocated.
+    const size_t size = sizeClass(bytes);
+    if (reuse) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto entry = freeBlocks.find(size);
+        if (entry != freeBlocks.end() && !entry->second.empty()) {
+            void* block = entry->second.back();
+            entry->second.pop_back();
+            cachedBytes -= size;
+            reuses++;
+            reusedBytes += size;
+            return block;
+        }
+    }
+    allocations++;
+    allocatedBytes += size;
+    return ::operator new(size);
+}
+
+void BufferPool::release(void* block, size_t bytes, bool reuse) {
+    if (block == nullptr) {
+        return;
+    }
+    if (bytes < MinPooledBytes || !reuse) {
+        ::operator delete(block);
+        return;
+    }
+    const size_t size = sizeClass(bytes);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (cachedBytes + size <= maxCachedBytes) {
+            try {
+                freeBlocks[size].push_back(block);
+                cachedBytes += size;
+                return;
+            } catch (const std::bad_alloc&) {
+                // Unable to record the block; fall through and free it.
+            }
+        }
+    }
+    ::operator delete(block);
+}
+
+void BufferPool::setMaxCachedBytes(size_t maxBytes) {
+    maxCachedBytes = maxBytes;
+    trim(maxBytes);
+}
+
+void BufferPool::trim(size_t maxBytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto& entry : freeBlocks) {
+        while (cachedBytes > maxBytes && !entry.second.empty()) {
+            ::operator delete(entry.second.back());
+            entry.second.pop_back();
+            cachedBytes -= entry.first;
+        }
+    }
+}
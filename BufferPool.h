@@ -0,0 +1,125 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+// Nicholas McCarty
+// Copyright 2024 @ nicholasmccarty252@gmail.com
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A process-wide pool of previously used memory blocks. Large buffers
+ * (decoded images, row pointers, luminance planes, score maps and match
+ * lists) are returned to the pool instead of to the C library, and handed
+ * out again to later searches. Repeated searches therefore reuse memory
+ * whose pages are already mapped instead of page-faulting fresh
+ * allocations in every request.
+ *
+ * Blocks are kept in size classes with 8 classes per power of two, so a
+ * reused block wastes at most 12.5% of its size. Blocks smaller than
+ * MinPooledBytes are not pooled. The pool is shared by all threads and
+ * guarded by a mutex, which is cheap compared to the size of the
+ * buffers handled.
+ *
+ * A reused block keeps the NUMA placement of its earlier first touch.
+ * Callers that place pages by first touch therefore pass reuse = false,
+ * which always allocates (and frees) fresh memory of the same size class.
+ */
+class BufferPool {
+public:
+    /** Blocks smaller than this are allocated directly. */
+    static const size_t MinPooledBytes = 4096;
+
+    /** Returns the process-wide pool. It is never destroyed. */
+    static BufferPool& instance();
+
+    /**
+     * Allocates a block of at least the given size, reusing a pooled
+     * block of the same size class if one is available.
+     *
+     * \param[in] bytes The number of bytes needed.
+     * \param[in] reuse If false, a new block is allocated even if a
+     * pooled one is available.
+     *
+     * \returns The allocated block.
+     *
+     * \throws std::bad_alloc If memory cannot be allocated.
+     */
+    void* allocate(size_t bytes, bool reuse = true);
+
+    /**
+     * Returns a block to the pool. If the pool already holds
+     * getMaxCachedBytes() bytes, the block is freed instead.
+     *
+     * \param[in] block A block returned by allocate().
+     * \param[in] bytes The size passed to allocate() for this block.
+     * \param[in] reuse If false, the block is freed instead of pooled.
+     */
+    void release(void* block, size_t bytes, bool reuse = true);
+
+    /**
+     * Sets the maximum number of bytes kept in the pool. Blocks in excess
+     * of the new limit are freed.
+     *
+     * \param[in] maxBytes The new limit. Zero disables pooling.
+     */
+    void setMaxCachedBytes(size_t maxBytes);
+
+    /**
+     * Sets whether buffers whose pages are placed by first touch (see
+     * ImageBufferAllocator) may reuse pooled blocks. This is disabled when
+     * first touch places the pages on NUMA nodes (--numa).
+     *
+     * \param[in] reuse If false, such buffers bypass the pool.
+     */
+    void setReusePlacedBuffers(bool reuse) { reusePlaced = reuse; }
+
+    /** Returns true if buffers placed by first touch reuse pooled blocks. */
+    bool getReusePlacedBuffers() const { return reusePlaced; }
+
+    /** Returns the maximum number of bytes kept in the pool. */
+    size_t getMaxCachedBytes() const { return maxCachedBytes; }
+
+    /** Returns the number of bytes currently held in the pool. */
+    size_t getCachedBytes() const { return cachedBytes; }
+
+    /** Returns the number and total size of newly allocated blocks. */
+    size_t getAllocations()     const { return allocations;     }
+    size_t getAllocatedBytes()  const { return allocatedBytes;  }
+
+    /** Returns the number and total size of blocks served from the pool,
+        i.e., the allocations that have been avoided. */
+    size_t getReuses()          const { return reuses;          }
+    size_t getReusedBytes()     const { return reusedBytes;     }
+
+private:
+    /** Use instance() to obtain the pool. */
+    BufferPool();
+
+    /** Rounds a size up to its size class. */
+    static size_t sizeClass(size_t bytes);
+
+    /** Frees pooled blocks until at most maxBytes are cached. */
+    void trim(size_t maxBytes);
+
+    /** Guards freeBlocks and cachedBytes. */
+    std::mutex lock;
+
+    /** The pooled blocks, keyed by size class. */
+    std::unordered_map<size_t, std::vector<void*>> freeBlocks;
+
+    /** Limit and current total of the pooled blocks. */
+    std::atomic<size_t> maxCachedBytes, cachedBytes{0};
+
+    /** True if buffers placed by first touch reuse pooled blocks. */
+    std::atomic<bool> reusePlaced{true};
+
+    /** Statistics reported by the accessors. */
+    std::atomic<size_t> allocations{0}, allocatedBytes{0};
+    std::atomic<size_t> reuses{0}, reusedBytes{0};
+};
+
+#endif
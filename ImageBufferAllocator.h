@@ -0,0 +1,117 @@
+#ifndef IMAGE_BUFFER_ALLOCATOR_H
+#define IMAGE_BUFFER_ALLOCATOR_H
+
+// Nicholas McCarty
+// Copyright 2024 @ nicholasmccarty252@gmail.com
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include "BufferPool.h"
+
+/**
+ * An allocator that obtains memory from and returns it to the BufferPool,
+ * so that buffers of repeated searches reuse previously allocated memory.
+ * Elements are constructed as by std::allocator.
+ */
+template <typename T>
+class PoolAllocator : public std::allocator<T> {
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = PoolAllocator<U>; };
+
+    PoolAllocator() noexcept = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    /** Allocate space for n elements from the BufferPool. */
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(BufferPool::instance().allocate(n * sizeof(T)));
+    }
+
+    /** Return space for n elements to the BufferPool. */
+    void deallocate(T* ptr, std::size_t n) noexcept {
+        BufferPool::instance().release(ptr, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { 
+    return true; 
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { 
+    return false; 
+}
+
+/**
+ * The (row, col) of the top-left corner of each matched window of a
+ * search, allocated from the BufferPool.
+ */
+using MatchList = std::vector<std::pair<int, int>, 
+                              PoolAllocator<std::pair<int, int>>>;
+
+/**
+ * An allocator for large pixel buffers that default-initializes elements
+ * instead of value-initializing them. Resizing a std::vector using this
+ * allocator therefore does not write zeros to the new memory, leaving the
+ * first write ("first touch") of each page, and hence its NUMA placement,
+ * to the code that actually fills the buffer.
+ *
+ * Memory is obtained from the BufferPool. A reused block keeps the
+ * placement of its earlier first touch, so pooled blocks are only reused
+ * if BufferPool::getReusePlacedBuffers() is true.
+ */
+template <typename T>
+class ImageBufferAllocator : public std::allocator<T> {
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind { using other = ImageBufferAllocator<U>; };
+
+    ImageBufferAllocator() noexcept = default;
+
+    template <typename U>
+    ImageBufferAllocator(const ImageBufferAllocator<U>&) noexcept {}
+
+    /** Allocate space for n elements from the BufferPool. */
+    T* allocate(std::size_t n) {
+        BufferPool& pool = BufferPool::instance();
+        return static_cast<T*>(pool.allocate(n * sizeof(T), 
+                                             pool.getReusePlacedBuffers()));
+    }
+
+    /** Return space for n elements to the BufferPool. */
+    void deallocate(T* ptr, std::size_t n) noexcept {
+        BufferPool& pool = BufferPool::instance();
+        pool.release(ptr, n * sizeof(T), pool.getReusePlacedBuffers());
+    }
+
+    /** Default-initialize (i.e., leave uninitialized) trivial types. */
+    template <typename U>
+    void construct(U* ptr) noexcept {
+        ::new(static_cast<void*>(ptr)) U;
+    }
+
+    /** All other constructions are forwarded as usual. */
+    template <typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) {
+        ::new(static_cast<void*>(ptr)) U(std::forward<Args>(args)...);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const ImageBufferAllocator<T>&,
+                const ImageBufferAllocator<U>&) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const ImageBufferAllocator<T>&,
+                const ImageBufferAllocator<U>&) { return false; }
+
+#endif
@@ -0,0 +1,138 @@
+// Nicholas McCarty
+// Copyright 2024 @ nicholasmccarty252@gmail.com
+
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "Numa.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * Parses a Linux CPU list such as "0-3,8-11" into individual CPU numbers.
+ *
+ * \param[in] list The CPU list to be parsed.
+ *
+ * \returns The CPUs in the list.
+ */
+static std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::istringstream is(list);
+    for (std::string range; std::getline(is, range, ',');) {
+        if (range.empty() || !std::isdigit(range[0])) {
+            continue;
+        }
+        const auto dash  = range.find('-');
+        const int  first = std::stoi(range);
+        const int  last  = (dash == std::string::npos) ? first :
+            std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+NumaTopology::NumaTopology() {
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator("/sys/devices/system/node",
+                                                    ec)) {
+        const std::string name = entry.path().filename().string();
+        if (name.rfind("node", 0) != 0 || name.size() < 5 ||
+            !std::isdigit(name[4])) {
+            continue;
+        }
+        const size_t node = std::stoi(name.substr(4));
+        std::ifstream in(entry.path() / "cpulist");
+        std::string list;
+        std::getline(in, list);
+        if (node >= nodeCpus.size()) {
+            nodeCpus.resize(node + 1);
+        }
+        nodeCpus[node] = parseCpuList(list);
+    }
+    if (nodeCpus.empty()) {
+        // No NUMA information: a single node with all CPUs.
+        nodeCpus.resize(1);
+        const int numCpus = std::max(1U, std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < numCpus; cpu++) {
+            nodeCpus[0].push_back(cpu);
+        }
+    }
+    for (size_t node = 0; node < nodeCpus.size(); node++) {
+        for (const int cpu : nodeCpus[node]) {
+            if (cpu >= static_cast<int>(cpuNode.size())) {
+                cpuNode.resize(cpu + 1, 0);
+            }
+            cpuNode[cpu] = node;
+        }
+    }
+}
+
+const NumaTopology& NumaTopology::get() {
+    static const NumaTopology topology;
+    return topology;
+}
+
+int NumaTopology::nodeOfCpu(int cpu) const {
+    return (cpu >= 0 && cpu < static_cast<int>(cpuNode.size())) ?
+        cpuNode[cpu] : 0;
+}
+
+std::vector<int> NumaTopology::cpuOrder(bool scatter) const {
+    std::vector<int> order;
+    if (!scatter) {
+        for (const auto& cpus : nodeCpus) {
+            order.insert(order.end(), cpus.begin(), cpus.end());
+        }
+        return order;
+    }
+    // Take the i-th CPU of every node before the (i+1)-th of any node.
+    for (size_t i = 0, added = 1; added > 0; i++) {
+        added = 0;
+        for (const auto& cpus : nodeCpus) {
+            if (i < cpus.size()) {
+                order.push_back(cpus[i]);
+                added++;
+            }
+        }
+    }
+    return order;
+}
+
+std::vector<size_t> NumaTopology::pagesPerNode(const void* addr,
+                                               size_t bytes) const {
+    std::vector<size_t> counts(getNumNodes());
+    const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    const uintptr_t start    = reinterpret_cast<uintptr_t>(addr) &
+        ~(pageSize - 1);
+    const uintptr_t end      = reinterpret_cast<uintptr_t>(addr) + bytes;
+    // Query placement in batches; move_pages with no target nodes only
+    // reports the node of each page.
+    const size_t Batch = 4096;
+    std::vector<void*> pages;
+    std::vector<int> status(Batch);
+    for (uintptr_t page = start; page < end;) {
+        pages.clear();
+        for (; page < end && pages.size() < Batch; page += pageSize) {
+            pages.push_back(reinterpret_cast<void*>(page));
+        }
+        if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr,
+                    status.data(), 0) != 0) {
+            break;
+        }
+        for (size_t i = 0; i < pages.size(); i++) {
+            if (status[i] >= 0 && status[i] < getNumNodes()) {
+                counts[status[i]]++;
+            }
+        }
+    }
+    return counts;
+}
@@ -0,0 +1,73 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+// Nicholas McCarty
+// Copyright 2024 @ nicholasmccarty252@gmail.com
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * The NUMA layout of the machine as reported by Linux in
+ * /sys/devices/system/node. On systems without that information all
+ * online CPUs are treated as a single node. This class does not depend on
+ * libnuma; page placement is queried with the move_pages system call.
+ */
+class NumaTopology {
+public:
+    /** Returns the topology of this machine, detected on first use. */
+    static const NumaTopology& get();
+
+    /** Returns the number of NUMA nodes (at least 1). */
+    int getNumNodes() const { return static_cast<int>(nodeCpus.size()); }
+
+    /**
+     * Returns the node of a given CPU.
+     *
+     * \param[in] cpu The CPU number.
+     *
+     * \returns The node of the CPU, or 0 if it is unknown.
+     */
+    int nodeOfCpu(int cpu) const;
+
+    /**
+     * Returns the CPUs of a given node.
+     *
+     * \param[in] node The node number, 0 <= node < getNumNodes().
+     */
+    const std::vector<int>& cpusOfNode(int node) const {
+        return nodeCpus[node];
+    }
+
+    /**
+     * Returns the order in which CPUs are to be assigned to threads.
+     *
+     * \param[in] scatter If false, all CPUs of node 0 come first, then those
+     * of node 1 and so on ("compact"). If true, consecutive entries come
+     * from different nodes ("scatter").
+     */
+    std::vector<int> cpuOrder(bool scatter) const;
+
+    /**
+     * Counts the pages of a memory range that reside on each node.
+     * Pages that have not been touched yet are not counted.
+     *
+     * \param[in] addr The start of the memory range.
+     * \param[in] bytes The size of the memory range.
+     *
+     * \returns The number of pages on each node (size getNumNodes()).
+     */
+    std::vector<size_t> pagesPerNode(const void* addr, size_t bytes) const;
+
+private:
+    /** Detects the topology from sysfs. */
+    NumaTopology();
+
+    /** The CPUs of each node. */
+    std::vector<std::vector<int>> nodeCpus;
+
+    /** The node of each CPU, indexed by CPU number. */
+    std::vector<int> cpuNode;
+};
+
+#endif
@@ -24,6 +24,10 @@
 #include "PNG.h"
 #include "Assert.h"
 #include <string>
+#include <algorithm>
+
+/** The function used to first-touch new buffers (see setFirstTouch). */
+static PNG::FirstTouchFn firstTouch;
 
 PNG::PNG() {
     width  = 0;
@@ -31,7 +35,7 @@ PNG::PNG() {
 }
 
 PNG::PNG(const PNG& src) : width(src.width), height(src.height) {
-    prepareBuffer();
+    prepareBuffer(false);
     flatImageBuffer = src.flatImageBuffer;
 }
 
@@ -42,7 +46,7 @@ PNG&
 PNG::operator=(const PNG& src) {
     this->width  = src.width;
     this->height = src.height;
-    prepareBuffer();
+    prepareBuffer(false);
     flatImageBuffer = src.flatImageBuffer;
     return *this;
 }
@@ -71,8 +75,8 @@ PNG::validateHeader(const char* fileName) {
     return pngFile;
 }
 
-void
-PNG::open(const char* fileName) {
+bool
+PNG::open(const char* fileName, Buffer* luminance) {
     ASSERT(pngInfo == NULL);
     // Try to open the file and validate the PNG header in it.
     FILE *pngFile = validateHeader(fileName);
@@ -85,23 +89,61 @@ PNG::open(const char* fileName) {
     png_set_sig_bytes(libpngHandle, 8);
     // Actually read the info
     png_read_info(libpngHandle, pngInfo);
+    // Have libpng convert the image to 8-bit RGBA (or gray + alpha)
+    const bool gray = normalizeFormat(libpngHandle, pngInfo,
+                                      luminance != NULL);
     // Unfortunately, we now need to consider interlace handling
     png_set_interlace_handling(libpngHandle);
     // And update the information struc accordingly
     png_read_update_info(libpngHandle, pngInfo);
 
     // Finally, make sure this is a PNG we can handle
-    if (png_get_color_type(libpngHandle, pngInfo) != PNG_COLOR_TYPE_RGBA) {
+    const int colorType = gray ? PNG_COLOR_TYPE_GRAY_ALPHA :
+        PNG_COLOR_TYPE_RGBA;
+    if (png_get_color_type(libpngHandle, pngInfo) != colorType) {
         throw std::runtime_error("Specified PNG is not in RGBA color mode");
     }
     if (png_get_bit_depth(libpngHandle, pngInfo) != 8) {
         throw std::runtime_error("Specified PNG does not have bit depth of 8");
     }
     // Use helper method to load the actual image data
-    load(libpngHandle, pngInfo);
+    if (gray) {
+        loadGray(libpngHandle, pngInfo, *luminance);
+    } else {
+        load(libpngHandle, pngInfo);
+    }
     // Close the PNG file
     fclose(pngFile);
     png_destroy_read_struct(&libpngHandle, &pngInfo, NULL);
+    return gray;
+}
+
+bool
+PNG::normalizeFormat(png_structp libpngHandle, png_infop pngInfo,
+                     bool keepGray) {
+    const int colorType = png_get_color_type(libpngHandle, pngInfo);
+    const int bitDepth  = png_get_bit_depth(libpngHandle, pngInfo);
+    const bool isGray   = !(colorType & PNG_COLOR_MASK_COLOR);
+    const bool hasTRNS  = png_get_valid(libpngHandle, pngInfo, PNG_INFO_tRNS);
+    if (colorType == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(libpngHandle);
+    }
+    if (isGray && (bitDepth < 8)) {
+        png_set_expand_gray_1_2_4_to_8(libpngHandle);
+    }
+    if (hasTRNS) {
+        png_set_tRNS_to_alpha(libpngHandle);
+    }
+    if (bitDepth == 16) {
+        png_set_strip_16(libpngHandle);
+    }
+    if (isGray && !keepGray) {
+        png_set_gray_to_rgb(libpngHandle);
+    }
+    if (!(colorType & PNG_COLOR_MASK_ALPHA) && !hasTRNS) {
+        png_set_add_alpha(libpngHandle, 0xff, PNG_FILLER_AFTER);
+    }
+    return isGray && keepGray;
 }
 
 void
@@ -109,6 +151,11 @@ PNG::load(const std::string& fileName) {
     open(fileName.c_str());
 }
 
+bool
+PNG::load(const std::string& fileName, Buffer& luminance) {
+    return open(fileName.c_str(), &luminance);
+}
+
 void
 PNG::load(png_structp libpngHandle, png_infop pngInfo) {
     // Okay... This is where things get weird. Since libpng is a C
@@ -126,12 +173,50 @@ PNG::load(png_structp libpngHandle, png_infop pngInfo) {
     // Save width and height for future use.
     width  = png_get_image_width(libpngHandle, pngInfo);
     height = png_get_image_height(libpngHandle, pngInfo);
-    // Prepare the in-memory buffer to load image
-    prepareBuffer();
+    // Prepare the in-memory buffer to load image. All pixels are about
+    // to be overwritten, so there is no need to clear the buffer.
+    prepareBuffer(false);
     // Read the data into our internal buffers.
     png_read_image(libpngHandle, &rowPointers[0]);
 }
 
+void
+PNG::loadGray(png_structp libpngHandle, png_infop pngInfo,
+              Buffer& luminance) {
+    // See load(png_structp, png_infop) for details on this setjmp.
+    if (setjmp(png_jmpbuf(libpngHandle)) != 0) {
+        // An error occured
+        throw std::runtime_error("libpng failed to load image bytes");
+    }
+
+    ASSERT(libpngHandle != NULL);
+    ASSERT(pngInfo      != NULL);
+    width  = png_get_image_width(libpngHandle, pngInfo);
+    height = png_get_image_height(libpngHandle, pngInfo);
+    prepareBuffer(false);
+    luminance.resize(width * height);
+    if (firstTouch && !luminance.empty()) {
+        firstTouch(luminance.data(), width, height);
+    }
+    // Decode the gray + alpha rows packed into the first half of the
+    // pixel buffer.
+    unsigned char* const bufStart = flatImageBuffer.data();
+    std::vector<unsigned char*> grayRows(height);
+    for (int row = 0; (row < height); row++) {
+        grayRows[row] = bufStart + (row * width * 2);
+    }
+    png_read_image(libpngHandle, grayRows.data());
+    // Expand to RGBA in place. Working backwards from the last pixel
+    // ensures that no gray value is overwritten before it is read.
+    for (int i = width * height - 1; (i >= 0); i--) {
+        const unsigned char gray  = bufStart[2 * i];
+        const unsigned char alpha = bufStart[2 * i + 1];
+        luminance[i]        = gray;
+        bufStart[4 * i]     = bufStart[4 * i + 1] = bufStart[4 * i + 2] = gray;
+        bufStart[4 * i + 3] = alpha;
+    }
+}
+
 void
 PNG::create(int width, int height) {
     this->width  = width;
@@ -208,12 +293,21 @@ PNG::getBufferSize() const {
 }
 
 void
-PNG::prepareBuffer() {
+PNG::prepareBuffer(bool zeroFill) {
+    const unsigned char* const oldStart = flatImageBuffer.data();
     flatImageBuffer.clear();
     flatImageBuffer.resize(getBufferSize());
     rowPointers.resize(height);
-    unsigned char* const bufStart = &flatImageBuffer[0];
+    unsigned char* const bufStart = flatImageBuffer.data();
     const int rowBytes            = width * 4;
+    // Newly allocated memory is first-touched by the configured function
+    // so that its pages end up close to the threads that use them.
+    const bool newMemory = (bufStart != oldStart);
+    if (!flatImageBuffer.empty() && firstTouch && (newMemory || zeroFill)) {
+        firstTouch(bufStart, rowBytes, height);
+    } else if (zeroFill) {
+        std::fill(flatImageBuffer.begin(), flatImageBuffer.end(), 0);
+    }
     for (int row = 0; (row < height); row++) {
         rowPointers[row] = bufStart + (row * rowBytes);
     }
@@ -221,6 +315,32 @@ PNG::prepareBuffer() {
 
 
 
+bool
+PNG::getLuminance(Buffer& plane) const {
+    plane.resize(width * height);
+    return getLuminance(plane.data(), 0, height);
+}
+
+bool
+PNG::getLuminance(unsigned char* plane, int startRow, int endRow) const {
+    const unsigned char* pix = flatImageBuffer.data() + startRow * width * 4;
+    unsigned char* out       = plane + startRow * width;
+    const int numPixels      = (endRow - startRow) * width;
+    bool lossless = true;
+    for (int i = 0; (i < numPixels); i++, pix += 4) {
+        // Y = 0.299R + 0.587G + 0.114B. The weights add up to 256, so
+        // this yields exactly R when R = G = B.
+        lossless = lossless && (pix[0] == pix[1]) && (pix[1] == pix[2]);
+        out[i]   = (77 * pix[0] + 150 * pix[1] + 29 * pix[2] + 128) >> 8;
+    }
+    return lossless;
+}
+
+void
+PNG::setFirstTouch(FirstTouchFn fn) {
+    firstTouch = std::move(fn);
+}
+
 void
 PNG::setRed(const int row, const int col) {
     const int idx = (row * width + col) * 4;
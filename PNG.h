@@ -26,6 +26,8 @@
 #include <cstdio>
 #include <vector>
 #include <string>
+#include <functional>
+#include "ImageBufferAllocator.h"
 
 /**
    A convenience union to access individual components of a pixel. For
@@ -44,6 +46,20 @@ typedef union Pix {
 
 class PNG {
 public:
+    /** The type of the flat pixel buffers. The allocator does not
+        zero-fill new memory so that pages are placed on the NUMA node
+        of the thread that first writes them (see setFirstTouch).
+    */
+    using Buffer = std::vector<unsigned char,
+                                ImageBufferAllocator<unsigned char>>;
+
+    /** A function that writes zeros to every row of a new buffer.
+
+        The parameters are the start of the buffer, the number of
+        bytes per row, and the number of rows.
+    */
+    using FirstTouchFn = std::function<void(unsigned char*, int, int)>;
+
     /** The default constructor which creates an empty PNG image in memory.
 
         This constructor is present so that it is convenient to use
@@ -93,7 +109,8 @@ public:
     /** \brief Open and load the specified PNG
 
         This method reads the image data from a given file into
-        internal buffers.
+        internal buffers. Palette, grayscale, and 16-bit images, with
+        or without alpha, are converted to 8-bit RGBA while decoding.
 
         \param[in] fileName The path to the PNG file from where the
         image is to be loaded.
@@ -102,6 +119,25 @@ public:
     */
     void load(const std::string& fileName);
 
+    /** \brief Open and load the specified PNG, along with its
+        luminance plane if the image is stored in grayscale.
+
+        This method is the same as load(const std::string&). However,
+        if the PNG file is a grayscale image, the gray values are also
+        stored directly into the given luminance plane while decoding,
+        which makes a separate call to getLuminance() unnecessary.
+
+        \param[in] fileName The path to the PNG file from where the
+        image is to be loaded.
+
+        \param[out] luminance The luminance plane. It is filled with
+        width * height bytes only if this method returns true.
+
+        \return True if the file is a grayscale PNG and the luminance
+        plane has been filled (losslessly).
+    */
+    bool load(const std::string& fileName, Buffer& luminance);
+
     /** \brief Write the image from internal buffers to a given PNG
         file.
 
@@ -157,7 +193,7 @@ public:
         \return A reference to the flat image buffer that contains the
         pixels.
     */
-    inline const std::vector<unsigned char>& getBuffer() const
+    inline const Buffer& getBuffer() const
     { return flatImageBuffer; }
 
     /** Get an mutable reference to the flat buffer image.
@@ -168,7 +204,54 @@ public:
         \return A reference to the flat image buffer that contains the
         pixels.
     */    
-    inline std::vector<unsigned char>& getBuffer() { return flatImageBuffer; }
+    inline Buffer& getBuffer() { return flatImageBuffer; }
+
+    /** \brief Convert this image to an 8-bit luminance plane.
+
+        Each pixel is reduced to a single byte in row-major order. If
+        every pixel has equal red, green, and blue components (the
+        image is effectively grayscale) the red component is used and
+        the conversion is lossless. Otherwise the luminance is computed
+        using integer Rec. 601 weights.
+
+        \param[out] plane The buffer to be filled with width * height
+        luminance values.
+
+        \return True if the conversion was lossless, i.e., all pixels
+        have R = G = B.
+    */
+    bool getLuminance(Buffer& plane) const;
+
+    /** \brief Convert a band of rows to an 8-bit luminance plane.
+
+        This method is the same as getLuminance(Buffer&) but converts
+        only the rows in the range [startRow, endRow), so that a large
+        image can be converted in parallel.
+
+        \param[out] plane The start of a buffer of width * height bytes
+        for the whole image. Only the given rows are written.
+
+        \param[in] startRow The first row to be converted.
+
+        \param[in] endRow One past the last row to be converted.
+
+        \return True if R = G = B for all pixels in the given rows.
+    */
+    bool getLuminance(unsigned char* plane, int startRow, int endRow) const;
+
+    /** \brief Set the function used to first-touch new pixel buffers.
+
+        On NUMA machines the pages of a buffer are placed on the node
+        of the thread that first writes them. If a function is set,
+        prepareBuffer() calls it to zero-fill new buffers, typically in
+        row bands using the threads that will later process those
+        bands. Otherwise buffers are zero-filled by the calling thread
+        when needed.
+
+        \param[in] fn The function to be used. An empty function
+        restores the default behavior.
+    */
+    static void setFirstTouch(FirstTouchFn fn);
 
 	/** Set a given pixel in the PNG image to red color.
 
@@ -191,10 +274,52 @@ protected:
 
         \param[in] fileName A relative or absolute path to the PNG file
 
+        \param[out] luminance If not NULL and the file is a grayscale
+        PNG, the gray values are decoded into this plane as well.
+
+        \return True if the luminance plane has been filled.
+
         \throws std::runtime_error If the the file specified cannot be
         read or is not a PNG file.
     */
-    void open(const char* fileName);
+    bool open(const char* fileName, Buffer* luminance = NULL);
+
+    /** Setup libpng transformations to normalize the image format.
+
+        This method is called from open() after the PNG header has been
+        read. It requests palette expansion, expansion of low bit-depth
+        grayscale, conversion of tRNS chunks to alpha, stripping of 16
+        bit channels to 8 bits, and addition of an opaque alpha channel
+        so that every PNG is decoded as 8-bit RGBA.
+
+        \param[in] libpngHandle The handle used to read the image.
+
+        \param[in] pngInfo The information about the image.
+
+        \param[in] keepGray If true, grayscale images are not expanded
+        to RGB but decoded as 8-bit gray + alpha.
+
+        \return True if the image will be decoded as gray + alpha.
+    */
+    bool normalizeFormat(png_structp libpngHandle, png_infop pngInfo,
+                         bool keepGray);
+
+    /** Loads a grayscale image and its luminance plane via libpng.
+
+        This method is the counterpart of load(png_structp, png_infop)
+        for images decoded as 8-bit gray + alpha. The rows are decoded
+        into the pixel buffer and then expanded in place to RGBA while
+        the gray values are copied to the luminance plane.
+
+        \param[in,out] libpngHandle The handle to be used to read the
+        actual image data.
+
+        \param[in] pngInfo The information about the image.
+
+        \param[out] luminance The luminance plane to be filled.
+    */
+    void loadGray(png_structp libpngHandle, png_infop pngInfo,
+                  Buffer& luminance);
 
     /** Loads the actual image via calls to libpng.
 
@@ -215,8 +340,12 @@ protected:
         This is a convenience method that is used to setup the
         necessary buffer size and establish the cross reference
         pointers used internally by this PNG object.
+
+        \param[in] zeroFill If true the buffer is cleared to zeros.
+        Callers that overwrite all pixels anyway pass false. New memory
+        is always first-touched via the FirstTouchFn, if one is set.
     */
-    void prepareBuffer();
+    void prepareBuffer(bool zeroFill = true);
 
     /** Create read/write png handle and setup jump handle as required
         by libPNG.
@@ -290,14 +419,14 @@ private:
         image. Each pixel is a 32-bit number that contains data in
         RGBA format. The pixels are stored in row major format.
     */
-    std::vector<unsigned char> flatImageBuffer;
+    Buffer flatImageBuffer;
 
     /**
        Pointers to the starting entry in each row of the image. This
        set of pointers is needed and used by libpng to load and write
        images  to-and-from files.
     */
-    std::vector<unsigned char*> rowPointers;
+    std::vector<unsigned char*, PoolAllocator<unsigned char*>> rowPointers;
 };
 
 #endif
@@ -0,0 +1,229 @@
+// Nicholas McCarty
+// Copyright 2024 @ nicholasmccarty252@gmail.com
+
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include "ResultCache.h"
+
+namespace fs = std::filesystem;
+
+/** The first line of every match list file in the cache. */
+static const std::string CacheMagic = "IMCACHE1";
+
+/** Multipliers used by the hash (the 64-bit primes of xxHash). */
+static const uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+/** Final avalanche step so that every input bit affects every output bit. */
+static inline uint64_t fmix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 33);
+}
+
+ResultCache::ResultCache(const std::string& dir, uint64_t maxBytes,
+                         bool storeImages) :
+    dir(dir), maxBytes(maxBytes), storeImages(storeImages) {
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (!fs::is_directory(dir)) {
+        throw std::runtime_error("Cache directory (" + dir +
+                                 ") could not be created");
+    }
+}
+
+uint64_t ResultCache::hash(const unsigned char* data, size_t len,
+                           uint64_t seed) {
+    // Four independent lanes keep several multiplies in flight.
+    uint64_t lane[4] = { seed + Prime1 + Prime2, seed + Prime2, seed,
+                         seed - Prime1 };
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        for (int l = 0; l < 4; l++) {
+            uint64_t word;
+            std::memcpy(&word, data + i + l * 8, sizeof(word));
+            lane[l] = rotl(lane[l] + word * Prime2, 31) * Prime1;
+        }
+    }
+    uint64_t h = rotl(lane[0], 1) + rotl(lane[1], 7) + rotl(lane[2], 12) +
+        rotl(lane[3], 18) + len;
+    for (; i < len; i++) {
+        h = rotl(h ^ (data[i] * Prime1), 11) * Prime2;
+    }
+    return fmix(h);
+}
+
+std::string ResultCache::makeKey(const PNG& mainImg, const PNG& maskImg,
+                                 const std::vector<int>& params) const {
+    std::vector<int> desc = { mainImg.getWidth(), mainImg.getHeight(),
+                              maskImg.getWidth(), maskImg.getHeight() };
+    desc.insert(desc.end(), params.begin(), params.end());
+    const uint64_t seed = hash(reinterpret_cast<const unsigned char*>(
+                                   desc.data()), desc.size() * sizeof(int), 0);
+    const auto& mainBuf = mainImg.getBuffer();
+    const auto& maskBuf = maskImg.getBuffer();
+    const uint64_t h1 = hash(mainBuf.data(), mainBuf.size(), seed);
+    const uint64_t h2 = hash(maskBuf.data(), maskBuf.size(), h1 ^ seed);
+    std::ostringstream key;
+    key << std::hex << std::setfill('0') << std::setw(16) << h1
+        << std::setw(16) << h2;
+    return key.str();
+}
+
+std::string ResultCache::path(const std::string& key, const char* ext) const {
+    return (fs::path(dir) / (key + ext)).string();
+}
+
+bool ResultCache::lookup(const std::string& key, Matches& matches) {
+    std::ifstream in(path(key, ".matches"));
+    std::string magic, storedKey;
+    size_t count = 0;
+    if (!(in >> magic >> storedKey >> count) || magic != CacheMagic ||
+        storedKey != key) {
+        misses++;
+        return false;
+    }
+    // Read the pairs one by one rather than trusting count for the size
+    // of the list, so that a corrupt entry is a miss and not a bad_alloc.
+    matches.clear();
+    for (size_t i = 0; i < count; i++) {
+        std::pair<int, int> match;
+        if (!(in >> match.first >> match.second)) {
+            misses++;
+            return false;  // Truncated entry; treat it as missing.
+        }
+        matches.push_back(match);
+    }
+    // Refresh the time stamp so this entry is evicted last.
+    std::error_code ec;
+    fs::last_write_time(path(key, ".matches"),
+                        fs::file_time_type::clock::now(), ec);
+    hits++;
+    return true;
+}
+
+bool ResultCache::copyImage(const std::string& key,
+                            const std::string& outImageFile) {
+    std::error_code ec;
+    const std::string image = path(key, ".png");
+    if (!storeImages || !fs::exists(image, ec)) {
+        return false;
+    }
+    fs::last_write_time(image, fs::file_time_type::clock::now(), ec);
+    return fs::copy_file(image, outImageFile,
+                         fs::copy_options::overwrite_existing, ec) && !ec;
+}
+
+std::string ResultCache::tempPath(const std::string& key) {
+    return path(key, ".tmp.") + std::to_string(getpid()) + "." +
+        std::to_string(tempCounter++);
+}
+
+void ResultCache::copyIntoCache(const std::string& key,
+                                const std::string& outImageFile) {
+    std::error_code ec;
+    const std::string temp = tempPath(key);
+    if (storeImages && fs::copy_file(outImageFile, temp,
+                                     fs::copy_options::overwrite_existing,
+                                     ec)) {
+        fs::rename(temp, path(key, ".png"), ec);
+    }
+    if (ec) {
+        fs::remove(temp, ec);
+    }
+}
+
+void ResultCache::storeImage(const std::string& key,
+                             const std::string& outImageFile) {
+    if (storeImages) {
+        copyIntoCache(key, outImageFile);
+        evict();
+    }
+}
+
+void ResultCache::store(const std::string& key, const Matches& matches,
+                        const std::string& outImageFile) {
+    std::error_code ec;
+    copyIntoCache(key, outImageFile);
+    const std::string temp = tempPath(key);
+    {
+        std::ofstream out(temp);
+        out << CacheMagic << ' ' << key << ' ' << matches.size() << '\n';
+        for (const auto& match : matches) {
+            out << match.first << ' ' << match.second << '\n';
+        }
+    }
+    fs::rename(temp, path(key, ".matches"), ec);
+    if (ec) {
+        fs::remove(temp, ec);
+    }
+    evict();
+}
+
+void ResultCache::evict() {
+    // Group the files by key, so that the match list and image of an entry
+    // are evicted together. Temporary files of stores in progress are not
+    // counted or removed, unless they were left behind long ago.
+    struct Entry {
+        fs::file_time_type lastUsed = fs::file_time_type::min();
+        uint64_t bytes = 0;
+        std::vector<fs::path> files;
+    };
+    const auto staleTime = fs::file_time_type::clock::now() - 
+        std::chrono::hours(1);
+    std::error_code ec;
+    std::unordered_map<std::string, Entry> entries;
+    uint64_t totalBytes = 0;
+    for (const auto& file : fs::directory_iterator(dir, ec)) {
+        if (!file.is_regular_file(ec)) {
+            continue;
+        }
+        const std::string name = file.path().filename().string();
+        const fs::file_time_type time = file.last_write_time(ec);
+        if (name.find(".tmp.") != std::string::npos) {
+            if (time < staleTime) {
+                fs::remove(file.path(), ec);
+            }
+            continue;
+        }
+        Entry& entry = entries[name.substr(0, name.find('.'))];
+        entry.lastUsed = std::max(entry.lastUsed, time);
+        entry.bytes   += file.file_size(ec);
+        entry.files.push_back(file.path());
+        totalBytes    += file.file_size(ec);
+    }
+    if (totalBytes <= maxBytes) {
+        return;
+    }
+    std::vector<const Entry*> lru;
+    for (const auto& entry : entries) {
+        lru.push_back(&entry.second);
+    }
+    std::sort(lru.begin(), lru.end(), [](const Entry* a, const Entry* b) {
+        return a->lastUsed < b->lastUsed;
+    });
+    for (const Entry* entry : lru) {
+        if (totalBytes <= maxBytes) {
+            break;
+        }
+        for (const auto& file : entry->files) {
+            fs::remove(file, ec);
+        }
+        totalBytes -= entry->bytes;
+        evictions++;
+    }
+}
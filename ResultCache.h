@@ -0,0 +1,153 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+// Nicholas McCarty
+// Copyright 2024 @ nicholasmccarty252@gmail.com
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ImageBufferAllocator.h"
+#include "PNG.h"
+
+/**
+ * An on-disk, content-addressed cache of search results. Entries are keyed
+ * by a hash of the raw pixels of the main image and mask together with the
+ * search parameters. Each entry stores the list of matches and, optionally,
+ * the annotated output image, so a repeated query skips the scan (and the
+ * PNG encode) entirely. The total size of the cache directory is bounded;
+ * the least recently used entries are evicted first.
+ *
+ * All methods may be called concurrently from multiple searches. Entries
+ * are written to a temporary file and renamed into place.
+ */
+class ResultCache {
+public:
+    /** The (row, col) of the top-left corner of each matched window. */
+    using Matches = MatchList;
+
+    /**
+     * Creates a cache in the given directory, creating it if needed.
+     *
+     * \param[in] dir The directory holding the cache entries.
+     * \param[in] maxBytes The maximum total size of the cache files.
+     * \param[in] storeImages If true, annotated output images are cached
+     * in addition to the match lists.
+     *
+     * \throws std::runtime_error If the directory cannot be created.
+     */
+    ResultCache(const std::string& dir, uint64_t maxBytes,
+                bool storeImages = true);
+
+    /**
+     * Computes a 64-bit hash of a buffer. This is a 4-lane multiply/rotate
+     * hash that processes 32 bytes per iteration.
+     *
+     * \param[in] data The bytes to be hashed.
+     * \param[in] len The number of bytes.
+     * \param[in] seed The initial value used to derive the hash.
+     */
+    static uint64_t hash(const unsigned char* data, size_t len,
+                         uint64_t seed);
+
+    /**
+     * Computes the cache key for a search.
+     *
+     * \param[in] mainImg The decoded main image.
+     * \param[in] maskImg The decoded mask or search image.
+     * \param[in] params The parameters that affect the result (for example
+     * isMask, matchPercent and tolerance), in a fixed order.
+     *
+     * \returns The key as a string of 32 hexadecimal digits.
+     */
+    std::string makeKey(const PNG& mainImg, const PNG& maskImg,
+                        const std::vector<int>& params) const;
+
+    /**
+     * Looks up the matches of a search.
+     *
+     * \param[in] key The key returned by makeKey().
+     * \param[out] matches The cached matches on a hit.
+     *
+     * \returns True on a cache hit.
+     */
+    bool lookup(const std::string& key, Matches& matches);
+
+    /**
+     * Copies the cached annotated image of a search to a file.
+     *
+     * \param[in] key The key returned by makeKey().
+     * \param[in] outImageFile The file to which the image is copied.
+     *
+     * \returns True if the image was in the cache and has been copied.
+     */
+    bool copyImage(const std::string& key, const std::string& outImageFile);
+
+    /**
+     * Adds the result of a search to the cache and evicts old entries if
+     * the cache exceeds its size limit.
+     *
+     * \param[in] key The key returned by makeKey().
+     * \param[in] matches The matches found by the search.
+     * \param[in] outImageFile The annotated image written by the search.
+     * It is copied into the cache if images are being cached.
+     */
+    void store(const std::string& key, const Matches& matches,
+               const std::string& outImageFile);
+
+    /**
+     * Adds the annotated image of an entry to the cache. This is used when
+     * a lookup hit found the matches but the image had been evicted and
+     * was regenerated. Does nothing if images are not being cached.
+     *
+     * \param[in] key The key returned by makeKey().
+     * \param[in] outImageFile The annotated image written by the search.
+     */
+    void storeImage(const std::string& key, const std::string& outImageFile);
+
+    /** Returns the number of lookups that were hits. */
+    size_t getHits() const { return hits; }
+
+    /** Returns the number of lookups that were misses. */
+    size_t getMisses() const { return misses; }
+
+    /** Returns the number of entries removed to stay within the limit. */
+    size_t getEvictions() const { return evictions; }
+
+private:
+    /** Returns the path of a file in the cache for the given key. */
+    std::string path(const std::string& key, const char* ext) const;
+
+    /** Returns a unique temporary file name for the given key. */
+    std::string tempPath(const std::string& key);
+
+    /** Copies an annotated image into the cache if images are cached. */
+    void copyIntoCache(const std::string& key, 
+                       const std::string& outImageFile);
+
+    /**
+     * Removes least recently used entries (match list and image together)
+     * until the size limit is met. Temporary files are left alone unless
+     * they are over an hour old.
+     */
+    void evict();
+
+    /** The directory holding the cache files. */
+    std::string dir;
+
+    /** The maximum total size of the files in dir. */
+    uint64_t maxBytes;
+
+    /** True if annotated output images are cached. */
+    bool storeImages;
+
+    /** Statistics reported by the accessors. */
+    std::atomic<size_t> hits{0}, misses{0}, evictions{0};
+
+    /** Used to generate unique temporary file names. */
+    std::atomic<unsigned> tempCounter{0};
+};
+
+#endif
@@ -0,0 +1,168 @@
+// Nicholas McCarty
+// Copyright 2024 @ nicholasmccarty252@gmail.com
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
+#include <stdexcept>
+#include "ResultCache.h"
+#include "ScoreMap.h"
+
+/** The magic string identifying a score map file. */
+static const char ScoreMapMagic[8] = "IMSCORE";
+
+/** The version of the file layout written by create(). */
+static const uint32_t ScoreMapVersion = 2;
+
+ScoreMap::ScoreMap() : header(nullptr), scoreBase(nullptr), bgBase(nullptr),
+                       fileSize(0), maskPixels(0) {
+}
+
+ScoreMap::~ScoreMap() {
+    close();
+}
+
+void ScoreMap::close() {
+    if (header != nullptr) {
+        munmap(header, fileSize);
+    }
+    if (!pendingFile.empty()) {
+        // Never leave a partially written map behind.
+        ::unlink(pendingFile.c_str());
+        pendingFile.clear();
+    }
+    header    = nullptr;
+    scoreBase = nullptr;
+    bgBase    = nullptr;
+    fileSize  = 0;
+}
+
+void ScoreMap::map(int fd, bool writable) {
+    void* addr = mmap(nullptr, fileSize, PROT_READ | (writable ? PROT_WRITE :
+                      0), MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Unable to memory-map score map file");
+    }
+    header = static_cast<ScoreMapHeader*>(addr);
+}
+
+void ScoreMap::create(const std::string& fileName, int rows, int cols,
+                      int maskWidth, int maskHeight, Format format,
+                      int tolerance, uint32_t luminance, uint64_t imageHash) {
+    close();
+    maskPixels = maskWidth * maskHeight;
+    if (format == UInt16 && maskPixels > UINT16_MAX) {
+        throw std::runtime_error("Mask is too large for a uint16 score map");
+    }
+    // Lay out header, scores, and background map, each 64-byte aligned.
+    const size_t cells      = static_cast<size_t>(rows) * cols;
+    const size_t scoreBytes = cells * (format == Float32 ? sizeof(float) :
+                                       sizeof(uint16_t));
+    const size_t scoreOff   = (sizeof(ScoreMapHeader) + 63) / 64 * 64;
+    const size_t bgOff      = (scoreOff + scoreBytes + 63) / 64 * 64;
+    fileSize = bgOff + cells * sizeof(uint32_t);
+
+    const int fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Score map file (" + fileName +
+                                 ") could not be opened for writing");
+    }
+    if (ftruncate(fd, fileSize) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Unable to size score map file " + fileName);
+    }
+    map(fd, true);
+    pendingFile = fileName;
+    header->version     = ScoreMapVersion;
+    header->format      = format;
+    header->rows        = rows;
+    header->cols        = cols;
+    header->maskWidth   = maskWidth;
+    header->maskHeight  = maskHeight;
+    header->scoreOffset = scoreOff;
+    header->bgOffset    = bgOff;
+    header->tolerance   = tolerance;
+    header->luminance   = luminance;
+    header->imageHash   = imageHash;
+    scoreBase = reinterpret_cast<unsigned char*>(header) + scoreOff;
+    bgBase    = reinterpret_cast<uint32_t*>(
+        reinterpret_cast<unsigned char*>(header) + bgOff);
+}
+
+uint64_t ScoreMap::hashImages(const PNG& mainImg, const PNG& maskImg) {
+    const auto& mainBuf = mainImg.getBuffer();
+    const auto& maskBuf = maskImg.getBuffer();
+    // Seed each hash with the width so that images differing only in
+    // their shape hash differently.
+    const uint64_t h = ResultCache::hash(mainBuf.data(), mainBuf.size(), 
+                                         mainImg.getWidth());
+    return ResultCache::hash(maskBuf.data(), maskBuf.size(), 
+                             h ^ maskImg.getWidth());
+}
+
+void ScoreMap::finish() {
+    std::memcpy(header->magic, ScoreMapMagic, sizeof(header->magic));
+    pendingFile.clear();
+}
+
+void ScoreMap::open(const std::string& fileName) {
+    close();
+    const int fd = ::open(fileName.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        throw std::runtime_error("Score map file (" + fileName +
+                                 ") could not be opened for reading");
+    }
+    if (static_cast<size_t>(info.st_size) < sizeof(ScoreMapHeader)) {
+        ::close(fd);
+        throw std::runtime_error("File specified is not a valid score map");
+    }
+    fileSize = info.st_size;
+    map(fd, false);
+    const size_t cells     = static_cast<size_t>(header->rows) * header->cols;
+    const size_t scoreSize = (header->format == Float32) ? sizeof(float) :
+        sizeof(uint16_t);
+    // A uint16 map can only hold hit counts of masks up to UINT16_MAX pixels.
+    const uint64_t maskSize = static_cast<uint64_t>(header->maskWidth) *
+        header->maskHeight;
+    const uint64_t maxMask  = (header->format == UInt16) ? UINT16_MAX :
+        INT32_MAX;
+    if (std::memcmp(header->magic, ScoreMapMagic, sizeof(ScoreMapMagic)) ||
+        header->version != ScoreMapVersion || header->format > UInt16 ||
+        header->luminance > 2 ||
+        header->scoreOffset < sizeof(ScoreMapHeader) ||
+        maskSize == 0 || maskSize > maxMask ||
+        header->scoreOffset + cells * scoreSize > fileSize ||
+        header->bgOffset + cells * sizeof(uint32_t) > fileSize) {
+        close();
+        throw std::runtime_error("File specified is not a valid score map");
+    }
+    maskPixels = header->maskWidth * header->maskHeight;
+    scoreBase  = reinterpret_cast<unsigned char*>(header) +
+        header->scoreOffset;
+    bgBase     = reinterpret_cast<uint32_t*>(
+        reinterpret_cast<unsigned char*>(header) + header->bgOffset);
+}
+
+int ScoreMap::getScore(int row, int col) const {
+    const size_t idx = static_cast<size_t>(row) * header->cols + col;
+    if (header->format == Float32) {
+        return reinterpret_cast<const float*>(scoreBase)[idx];
+    }
+    return 2 * reinterpret_cast<const uint16_t*>(scoreBase)[idx] - maskPixels;
+}
+
+void ScoreMap::getScores(int* scores) const {
+    for (int row = 0; row < getRows(); row++) {
+        for (int col = 0; col < getCols(); col++) {
+            scores[static_cast<size_t>(row) * header->cols + col] =
+                getScore(row, col);
+        }
+    }
+}
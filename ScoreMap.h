@@ -0,0 +1,199 @@
+#ifndef SCORE_MAP_H
+#define SCORE_MAP_H
+
+// Nicholas McCarty
+// Copyright 2024 @ nicholasmccarty252@gmail.com
+
+#include <cstdint>
+#include <string>
+#include "PNG.h"
+
+/**
+ * The fixed-size header at the start of a score map file. All fields are
+ * in native byte order. The scores start at scoreOffset and hold one entry
+ * per window position in row-major order, followed by the background color
+ * map (one 32-bit RGBA value per window) at bgOffset.
+ */
+struct ScoreMapHeader {
+    /** Always "IMSCORE" followed by a NUL byte. It is written only once
+        all scores have been written (see ScoreMap::finish()). */
+    char magic[8];
+    /** Version of the file layout (currently 2). */
+    uint32_t version;
+    /** Storage format of the scores; see ScoreMap::Format. */
+    uint32_t format;
+    /** Number of window positions vertically and horizontally. */
+    uint32_t rows, cols;
+    /** Size of the mask; a window has maskWidth * maskHeight pixels. */
+    uint32_t maskWidth, maskHeight;
+    /** Byte offsets of the score and background maps in the file. */
+    uint64_t scoreOffset, bgOffset;
+    /** The tolerance the scores were computed with. */
+    int32_t tolerance;
+    /** The --luminance mode of the search: 0 = off, 1 = auto, 2 = on. */
+    uint32_t luminance;
+    /** Hash of the pixels of the main image and mask (see
+        ScoreMap::hashImages()). */
+    uint64_t imageHash;
+};
+
+/**
+ * A memory-mapped file holding the processRegion() score and background
+ * color of every window position of a search. The map is filled in by the
+ * parallel scan and can later be thresholded for any matchPercent without
+ * repeating the scan.
+ */
+class ScoreMap {
+public:
+    /** How the score of each window is stored. */
+    enum Format : uint32_t {
+        /** The net match (hits - misses) as a 32-bit float. */
+        Float32 = 0,
+        /** The number of hits as a 16-bit unsigned integer; the net match
+            is 2 * hits - maskWidth * maskHeight. */
+        UInt16 = 1
+    };
+
+    /** Creates an empty map that is not backed by any file. */
+    ScoreMap();
+
+    /** Unmaps the file (if any). An unfinished file is removed. */
+    ~ScoreMap();
+
+    ScoreMap(const ScoreMap&) = delete;
+    ScoreMap& operator=(const ScoreMap&) = delete;
+
+    /**
+     * Creates (or truncates) the given file, sizes it to hold the header
+     * and maps, and maps it into memory for writing. The file is not a
+     * valid score map until finish() is called; if it is closed before,
+     * for example because the search was cancelled, it is removed.
+     *
+     * \param[in] fileName Path to the score map file.
+     * \param[in] rows The number of window positions vertically.
+     * \param[in] cols The number of window positions horizontally.
+     * \param[in] maskWidth The width of the mask.
+     * \param[in] maskHeight The height of the mask.
+     * \param[in] format How the scores are to be stored.
+     * \param[in] tolerance The tolerance used to compute the scores.
+     * \param[in] luminance The luminance mode used to compute the scores
+     * (0 = off, 1 = auto, 2 = on).
+     * \param[in] imageHash The hashImages() value of the searched images.
+     *
+     * \throws std::runtime_error If the file cannot be created or mapped,
+     * or if the mask is too large for the UInt16 format.
+     */
+    void create(const std::string& fileName, int rows, int cols,
+                int maskWidth, int maskHeight, Format format, int tolerance,
+                uint32_t luminance, uint64_t imageHash);
+
+    /**
+     * Computes the hash of a main image and mask recorded in a score map,
+     * so that a map can be checked against the images it was computed
+     * from.
+     *
+     * \param[in] mainImg The decoded main image.
+     * \param[in] maskImg The decoded mask or search image.
+     */
+    static uint64_t hashImages(const PNG& mainImg, const PNG& maskImg);
+
+    /**
+     * Marks a file created by create() as complete by writing the magic
+     * string of its header. Call this once all windows have been set.
+     */
+    void finish();
+
+    /**
+     * Maps an existing score map file read-only and validates its header.
+     *
+     * \param[in] fileName Path to the score map file.
+     *
+     * \throws std::runtime_error If the file cannot be mapped or is not a
+     * valid score map.
+     */
+    void open(const std::string& fileName);
+
+    /**
+     * Records the score and background color of one window. Different
+     * windows may be set concurrently from different threads.
+     *
+     * \param[in] row The row of the window position.
+     * \param[in] col The column of the window position.
+     * \param[in] netMatch The value returned by processRegion().
+     * \param[in] bgRGBA The background color of the window.
+     */
+    void set(int row, int col, int netMatch, uint32_t bgRGBA) {
+        const size_t idx = static_cast<size_t>(row) * header->cols + col;
+        if (header->format == Float32) {
+            reinterpret_cast<float*>(scoreBase)[idx] = netMatch;
+        } else {
+            reinterpret_cast<uint16_t*>(scoreBase)[idx] =
+                (netMatch + maskPixels) / 2;
+        }
+        bgBase[idx] = bgRGBA;
+    }
+
+    /**
+     * Returns the net match (hits - misses) of one window.
+     *
+     * \param[in] row The row of the window position.
+     * \param[in] col The column of the window position.
+     */
+    int getScore(int row, int col) const;
+
+    /**
+     * Returns the background color of one window in RGBA format.
+     *
+     * \param[in] row The row of the window position.
+     * \param[in] col The column of the window position.
+     */
+    uint32_t getBackground(int row, int col) const {
+        return bgBase[static_cast<size_t>(row) * header->cols + col];
+    }
+
+    /**
+     * Copies all scores, as net match values, into a row-major array.
+     *
+     * \param[out] scores The array to be filled with getRows() *
+     * getCols() scores.
+     */
+    void getScores(int* scores) const;
+
+    /** Returns true if this object is backed by a mapped file. */
+    bool isOpen() const { return header != nullptr; }
+
+    int getRows()       const { return header->rows;       }
+    int getCols()       const { return header->cols;       }
+    int getMaskWidth()  const { return header->maskWidth;  }
+    int getMaskHeight() const { return header->maskHeight; }
+    int getTolerance()  const { return header->tolerance;  }
+    uint32_t getLuminance() const { return header->luminance; }
+    uint64_t getImageHash() const { return header->imageHash; }
+
+private:
+    /** Maps fileSize bytes of the given descriptor and sets up pointers. */
+    void map(int fd, bool writable);
+
+    /** Unmaps the current file, if any, and removes it if unfinished. */
+    void close();
+
+    /** The mapped file; the header is at its start. */
+    ScoreMapHeader* header;
+
+    /** Start of the score map within the mapping. */
+    unsigned char* scoreBase;
+
+    /** Start of the background color map within the mapping. */
+    uint32_t* bgBase;
+
+    /** Total size of the mapping in bytes. */
+    size_t fileSize;
+
+    /** Number of pixels in the mask (maskWidth * maskHeight). */
+    int maskPixels;
+
+    /** The file being written by create() until finish() is called. */
+    std::string pendingFile;
+};
+
+#endif
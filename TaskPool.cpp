@@ -0,0 +1,331 @@
+// Nicholas McCarty
+// Copyright 2024 @ nicholasmccarty252@gmail.com
+
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <exception>
+#include "TaskPool.h"
+
+/** The index of the calling thread within currentPool (-1 if none). */
+static thread_local int currentWorker = -1;
+
+/** The pool that owns the calling thread, if it is a worker thread. */
+static thread_local const TaskPool* currentPool = nullptr;
+
+SearchToken::SearchToken(Clock::duration timeout) :
+    cancelled(false), hasDeadline(timeout > Clock::duration::zero()),
+    deadline(Clock::now() + timeout) {
+}
+
+bool SearchToken::isExpired() const {
+    return hasDeadline && Clock::now() >= deadline;
+}
+
+bool SearchToken::isCancelled() const {
+    return cancelled || isExpired();
+}
+
+/**
+ * The shared state of one search submitted via TaskPool::run(). Tickets in
+ * the worker deques are shared pointers to this structure.
+ */
+struct TaskPool::Group {
+    /** The tiles to be executed for this search. */
+    std::vector<Task> tiles;
+    /** The token checked before each tile is started. */
+    const SearchToken* token = nullptr;
+    /** A contiguous band of tiles [next, end) yet to be claimed. */
+    struct Range {
+        std::atomic<size_t> next{0};
+        size_t end = 0;
+    };
+    /** One band per worker with affinity, otherwise a single band. */
+    std::vector<Range> ranges;
+    /** Counts of tiles executed and skipped. */
+    std::atomic<size_t> tilesRun{0}, tilesSkipped{0};
+    /** Set when the first tile of this group starts. */
+    std::atomic<bool> started{false};
+    SearchToken::Clock::time_point submitted, firstStart;
+    /** The first exception thrown by a tile, rethrown by run(). */
+    std::exception_ptr error;
+    /** Guards finished and error and signals completion. */
+    std::mutex lock;
+    std::condition_variable done;
+    size_t finished = 0;
+
+    /** Splits the tiles into the given number of equal bands. */
+    explicit Group(std::vector<Task> tileList, size_t numBands) :
+        tiles(std::move(tileList)), ranges(numBands) {
+        for (size_t band = 0; band < numBands; band++) {
+            ranges[band].next = band * tiles.size() / numBands;
+            ranges[band].end  = (band + 1) * tiles.size() / numBands;
+        }
+    }
+
+    /**
+     * Claims the next tile, preferring the band of the given worker.
+     *
+     * \returns The index of the tile or tiles.size() if none is left.
+     */
+    size_t claim(int worker) {
+        for (size_t i = 0; i < ranges.size(); i++) {
+            Range& range = ranges[(worker + i) % ranges.size()];
+            if (range.next < range.end) {
+                const size_t tile = range.next.fetch_add(1);
+                if (tile < range.end) {
+                    return tile;
+                }
+            }
+        }
+        return tiles.size();
+    }
+
+    /** Returns true if some tile has not been claimed yet. */
+    bool hasUnclaimed() const {
+        for (const auto& range : ranges) {
+            if (range.next < range.end) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Claims all remaining tiles at once.
+     *
+     * \returns The number of tiles claimed.
+     */
+    size_t claimAll() {
+        size_t claimed = 0;
+        for (auto& range : ranges) {
+            const size_t first = range.next.exchange(range.end);
+            claimed += (first < range.end) ? range.end - first : 0;
+        }
+        return claimed;
+    }
+};
+
+TaskPool::TaskPool(int numThreads) {
+    if (numThreads <= 0) {
+        numThreads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < numThreads; i++) {
+        workers.emplace_back(new Worker());
+    }
+    for (int i = 0; i < numThreads; i++) {
+        threads.emplace_back(&TaskPool::workerLoop, this, i);
+    }
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> guard(idleLock);
+        stopping = true;
+    }
+    idleCond.notify_all();
+    for (auto& thr : threads) {
+        thr.join();
+    }
+}
+
+TaskPool& TaskPool::shared(int numThreads) {
+    static TaskPool pool(numThreads);
+    return pool;
+}
+
+int TaskPool::workerIndex() {
+    return currentWorker;
+}
+
+void TaskPool::workerLoop(int index) {
+    currentWorker = index;
+    currentPool   = this;
+    while (!stopping) {
+        auto group = findTicket(index);
+        if (group) {
+            runTicket(group, index);
+            continue;
+        }
+        std::unique_lock<std::mutex> lk(idleLock);
+        idleCond.wait(lk, [this] { return stopping || queuedTickets > 0; });
+    }
+}
+
+std::shared_ptr<TaskPool::Group> TaskPool::findTicket(int index) {
+    const int numWorkers = static_cast<int>(workers.size());
+    // Own deque first, oldest ticket first so groups are served round-robin.
+    {
+        Worker& self = *workers[index];
+        std::lock_guard<std::mutex> guard(self.lock);
+        if (!self.tickets.empty()) {
+            auto group = std::move(self.tickets.front());
+            self.tickets.pop_front();
+            queuedTickets--;
+            return group;
+        }
+    }
+    // Steal from the back of the other workers' deques.
+    for (int i = 1; i < numWorkers; i++) {
+        Worker& victim = *workers[(index + i) % numWorkers];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tickets.empty()) {
+            auto group = std::move(victim.tickets.back());
+            victim.tickets.pop_back();
+            queuedTickets--;
+            return group;
+        }
+    }
+    return nullptr;
+}
+
+void TaskPool::pushTicket(std::shared_ptr<Group> group, int index) {
+    Worker& worker = *workers[index];
+    std::lock_guard<std::mutex> guard(worker.lock);
+    worker.tickets.push_back(std::move(group));
+    queuedTickets++;
+}
+
+void TaskPool::runTicket(std::shared_ptr<Group> group, int index) {
+    const size_t tileCount = group->tiles.size();
+    const size_t tile      = group->claim(index);
+    if (tile >= tileCount) {
+        return;  // All tiles of this group have been claimed; retire ticket.
+    }
+    size_t claimed = 1;
+    if (group->token->isCancelled()) {
+        // Claim and skip all remaining tiles at once instead of letting
+        // them wait for their turn in the queues.
+        claimed += group->claimAll();
+        group->tilesSkipped += claimed;
+    } else {
+        // Re-queue the ticket behind tickets of other searches before
+        // running the tile so idle workers can pick up the remainder.
+        if (group->hasUnclaimed()) {
+            pushTicket(group, index);
+        }
+        Worker& self = *workers[index];
+        self.tilesRun++;
+        if (!self.pinned) {
+            self.cpu = sched_getcpu();
+        }
+        if (!group->started.exchange(true)) {
+            group->firstStart = SearchToken::Clock::now();
+        }
+        try {
+            group->tiles[tile]();
+        } catch (...) {
+            std::lock_guard<std::mutex> guard(group->lock);
+            if (!group->error) {
+                group->error = std::current_exception();
+            }
+        }
+        group->tilesRun++;
+    }
+    pendingTiles -= claimed;
+    std::lock_guard<std::mutex> guard(group->lock);
+    if ((group->finished += claimed) == tileCount) {
+        group->done.notify_all();
+    }
+}
+
+SearchStats TaskPool::run(std::vector<Task> tiles, const SearchToken& token,
+                          bool affinity) {
+    SearchStats stats;
+    if (tiles.empty()) {
+        return stats;
+    }
+    auto group = std::make_shared<Group>(std::move(tiles),
+                                         affinity ? workers.size() : 1);
+    group->token     = &token;
+    group->submitted = SearchToken::Clock::now();
+    const size_t tileCount = group->tiles.size();
+
+    activeGroups++;
+    const size_t depth = (pendingTiles += tileCount);
+    size_t peak = peakPendingTiles;
+    while (depth > peak && !peakPendingTiles.compare_exchange_weak(peak,
+                                                                   depth)) {
+    }
+    // Hand out at most one ticket per worker for this group. With
+    // affinity each worker with a non-empty band gets a ticket to start on.
+    if (affinity) {
+        for (size_t i = 0; i < workers.size(); i++) {
+            if (group->ranges[i].next < group->ranges[i].end) {
+                pushTicket(group, i);
+            }
+        }
+    } else {
+        const size_t numTickets = std::min(tileCount, workers.size());
+        const unsigned first    = nextWorker.fetch_add(numTickets);
+        for (size_t i = 0; i < numTickets; i++) {
+            pushTicket(group, (first + i) % workers.size());
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(idleLock);
+    }
+    idleCond.notify_all();
+
+    std::unique_lock<std::mutex> lk(group->lock);
+    if (currentPool == this) {
+        // Nested search from a worker: help out rather than block a thread.
+        while (group->finished < tileCount) {
+            lk.unlock();
+            auto ticket = findTicket(currentWorker);
+            if (ticket) {
+                runTicket(ticket, currentWorker);
+                lk.lock();
+            } else {
+                lk.lock();
+                group->done.wait_for(lk, std::chrono::milliseconds(1));
+            }
+        }
+    } else {
+        group->done.wait(lk, [&] { return group->finished == tileCount; });
+    }
+    activeGroups--;
+
+    using Ms = std::chrono::duration<double, std::milli>;
+    const auto end     = SearchToken::Clock::now();
+    stats.latencyMs    = Ms(end - group->submitted).count();
+    stats.queueMs      = group->started ?
+        Ms(group->firstStart - group->submitted).count() : stats.latencyMs;
+    stats.tilesRun     = group->tilesRun;
+    stats.tilesSkipped = group->tilesSkipped;
+    stats.cancelled    = stats.tilesSkipped > 0;
+    if (group->error) {
+        std::rethrow_exception(group->error);
+    }
+    return stats;
+}
+
+SearchStats TaskPool::parallelFor(int count, int chunk,
+                                  const std::function<void(int, int)>& body,
+                                  const SearchToken& token, bool affinity) {
+    chunk = std::max(1, chunk);
+    std::vector<Task> tiles;
+    for (int begin = 0; begin < count; begin += chunk) {
+        const int end = std::min(count, begin + chunk);
+        tiles.emplace_back([&body, begin, end] { body(begin, end); });
+    }
+    return run(std::move(tiles), token, affinity);
+}
+
+bool TaskPool::pinWorkers(const std::vector<int>& cpus) {
+    bool pinnedAll = !cpus.empty();
+    for (size_t i = 0; i < threads.size() && !cpus.empty(); i++) {
+        const int cpu = cpus[i % cpus.size()];
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu, &cpuSet);
+        if (pthread_setaffinity_np(threads[i].native_handle(),
+                                   sizeof(cpuSet), &cpuSet) == 0) {
+            workers[i]->pinned = true;
+            workers[i]->cpu    = cpu;
+        } else {
+            pinnedAll = false;
+        }
+    }
+    return pinnedAll;
+}
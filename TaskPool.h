@@ -0,0 +1,237 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+// Nicholas McCarty
+// Copyright 2024 @ nicholasmccarty252@gmail.com
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A cancellation token with an optional deadline that is shared between the
+ * caller of a search and the tasks executing it. Tasks poll the token and
+ * stop doing work once it has been cancelled or its deadline has passed.
+ */
+class SearchToken {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * Creates a token, optionally with a deadline.
+     *
+     * \param[in] timeout The amount of time, from now, the search is allowed
+     * to run. A zero duration means the search has no deadline.
+     */
+    explicit SearchToken(Clock::duration timeout = Clock::duration::zero());
+
+    /** Requests that the associated search be abandoned. */
+    void cancel() { cancelled = true; }
+
+    /**
+     * Checks whether the search should stop.
+     *
+     * \returns True if cancel() was called or the deadline has passed.
+     */
+    bool isCancelled() const;
+
+    /**
+     * Checks whether the deadline (if any) has passed.
+     *
+     * \returns True if this token has a deadline that has expired.
+     */
+    bool isExpired() const;
+
+private:
+    /** Set by cancel(). */
+    std::atomic<bool> cancelled;
+
+    /** True if this token has a deadline. */
+    bool hasDeadline;
+
+    /** The point in time after which the search is abandoned. */
+    Clock::time_point deadline;
+};
+
+/**
+ * Per-search statistics reported by TaskPool::run().
+ */
+struct SearchStats {
+    /** Wall-clock time from submission to completion, in milliseconds. */
+    double latencyMs = 0;
+    /** Time spent queued before the first tile started, in milliseconds. */
+    double queueMs = 0;
+    /** Number of tiles that were executed. */
+    size_t tilesRun = 0;
+    /** Number of tiles skipped because the search was cancelled. */
+    size_t tilesSkipped = 0;
+    /** True if the search was cancelled or ran past its deadline. */
+    bool cancelled = false;
+};
+
+/**
+ * A work-stealing pool of threads shared by all searches in the process.
+ *
+ * Each search submits its work as a group of independent tiles. A group is
+ * represented in the worker queues by a small number of tickets; running a
+ * ticket executes the next tile of its group and, if tiles remain,
+ * re-queues the ticket at the back of the worker's deque. Consequently
+ * tiles from concurrent searches are interleaved round-robin rather than one
+ * search monopolizing the pool. Idle workers steal tickets from the back
+ * of other workers' deques.
+ */
+class TaskPool {
+public:
+    using Task = std::function<void()>;
+
+    /**
+     * Creates a pool with the given number of worker threads.
+     *
+     * \param[in] numThreads The number of workers. Zero selects the number
+     * of hardware threads.
+     */
+    explicit TaskPool(int numThreads = 0);
+
+    /** Stops and joins all worker threads. */
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    /**
+     * Returns the process-wide pool, creating it on first use.
+     *
+     * \param[in] numThreads The number of workers used if the pool has not
+     * been created yet. Ignored on subsequent calls.
+     */
+    static TaskPool& shared(int numThreads = 0);
+
+    /**
+     * Runs a group of tiles and blocks until all of them have finished or
+     * been skipped due to cancellation. This method may be called
+     * concurrently from many threads. When called from a pool worker the
+     * caller helps execute queued tiles instead of blocking, so nested
+     * searches do not oversubscribe the machine.
+     *
+     * \param[in] tiles The independent tasks that make up the search.
+     * \param[in] token The cancellation token checked before each tile.
+     * \param[in] affinity If true, the tiles are split into one
+     * contiguous band per worker and each worker runs the tiles of its own
+     * band before stealing from other bands. This keeps the data of a
+     * band on the worker that first touched it (see PNG::setFirstTouch).
+     *
+     * \returns The statistics for this search.
+     */
+    SearchStats run(std::vector<Task> tiles, const SearchToken& token,
+                    bool affinity = false);
+
+    /**
+     * Convenience method to split the range [0, count) into chunks of
+     * the given size and run them as a group.
+     *
+     * \param[in] count The number of items in the range.
+     * \param[in] chunk The number of items per tile.
+     * \param[in] body Invoked as body(begin, end) for each tile.
+     * \param[in] token The cancellation token checked before each tile.
+     * \param[in] affinity If true, worker i handles the i-th band of the
+     * range first (see run()).
+     */
+    SearchStats parallelFor(int count, int chunk,
+                            const std::function<void(int, int)>& body,
+                            const SearchToken& token, bool affinity = false);
+
+    /** Returns the number of worker threads in this pool. */
+    int getNumThreads() const { return static_cast<int>(workers.size()); }
+
+    /** Returns the number of tiles submitted but not yet started. */
+    size_t queueDepth() const { return pendingTiles; }
+
+    /** Returns the largest queueDepth() observed so far. */
+    size_t maxQueueDepth() const { return peakPendingTiles; }
+
+    /** Returns the number of searches currently running. */
+    size_t activeSearches() const { return activeGroups; }
+
+    /**
+     * Pins the worker threads to CPUs. Worker i is pinned to
+     * cpus[i % cpus.size()].
+     *
+     * \param[in] cpus The CPUs to be used, in order (see
+     * NumaTopology::cpuOrder()).
+     *
+     * \returns True if all workers were pinned successfully.
+     */
+    bool pinWorkers(const std::vector<int>& cpus);
+
+    /** Returns the number of tiles executed by a given worker. */
+    size_t getTilesRun(int worker) const { return workers[worker]->tilesRun; }
+
+    /**
+     * Returns the CPU of a given worker: the CPU it is pinned to, or the
+     * CPU it last ran a tile on if it is not pinned (-1 if unknown).
+     */
+    int getWorkerCpu(int worker) const { return workers[worker]->cpu; }
+
+    /**
+     * Returns the index of the calling pool worker, or -1 if the caller is
+     * not a worker of any pool.
+     */
+    static int workerIndex();
+
+private:
+    struct Group;
+
+    /** A worker's local deque of tickets, guarded by its own mutex. */
+    struct Worker {
+        std::mutex lock;
+        std::deque<std::shared_ptr<Group>> tickets;
+        /** Statistics: tiles run by this worker and its (last) CPU. */
+        std::atomic<size_t> tilesRun{0};
+        std::atomic<int> cpu{-1};
+        /** True if this worker has been pinned to cpu. */
+        std::atomic<bool> pinned{false};
+    };
+
+    /** The body of each worker thread. */
+    void workerLoop(int index);
+
+    /** Pops a ticket from the given worker's deque or steals one. */
+    std::shared_ptr<Group> findTicket(int index);
+
+    /** Executes one tile of a group and re-queues the ticket if needed. */
+    void runTicket(std::shared_ptr<Group> group, int index);
+
+    /** Pushes a ticket to the back of a worker's deque. */
+    void pushTicket(std::shared_ptr<Group> group, int index);
+
+    /** The per-thread deques. */
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    /** The worker threads. */
+    std::vector<std::thread> threads;
+
+    /** Used to park idle workers. */
+    std::mutex idleLock;
+    std::condition_variable idleCond;
+
+    /** Number of queued tickets; used to decide when workers may sleep. */
+    std::atomic<size_t> queuedTickets{0};
+
+    /** Counters reported by the accessors above. */
+    std::atomic<size_t> pendingTiles{0}, peakPendingTiles{0};
+    std::atomic<size_t> activeGroups{0};
+
+    /** Round-robin cursor used to spread tickets of new groups. */
+    std::atomic<unsigned> nextWorker{0};
+
+    /** Set by the destructor to stop the workers. */
+    std::atomic<bool> stopping{false};
+};
+
+#endif
@@ -11,8 +11,17 @@
 #include <unordered_map>
 #include <algorithm>
 #include <numeric>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <functional>
 #include <omp.h>
 #include "PNG.h"
+#include "TaskPool.h"
+#include "ScoreMap.h"
+#include "ResultCache.h"
+#include "Numa.h"
 
 // It is ok to use the following namespace declarations in C++ source
 // files only. They must never be used in header files.
@@ -24,13 +33,101 @@ using namespace std::string_literals;
 Pixel computeBackgroundPixel(const PNG& img1, const PNG& mask, const int 
     startRow, const int startCol, const int maxRow, const int maxCol);
 
-bool isOverlapping(const vector<pair<int, int>>& regions, int row, int col, 
-    const PNG& maskImg);
+/**
+ * The scores of all window positions of a search. Like PNG::Buffer the
+ * memory is not zero-filled on allocation, so its pages are placed by the
+ * tasks that write the scores.
+ */
+using ScoreBuffer = vector<int, ImageBufferAllocator<int>>;
+
+bool isOverlapping(const MatchList& regions, int row, int col, 
+    int maskWidth, int maskHeight);
+
+/**
+ * Re-scores the window at (row, col) on the main image with the boxes of
+ * the given matches drawn into it (see acceptMatches()).
+ */
+using RescoreFn = std::function<int(const MatchList& accepted, int row, 
+                                    int col)>;
+
+MatchList acceptMatches(const ScoreBuffer& scores, int rows, int cols, 
+    int maskWidth, int maskHeight, int matchPercent, 
+    const RescoreFn& rescore = nullptr);
+RescoreFn makeRescore(PNG& largeImg, const PNG& maskImg, PNG::Buffer& luma,
+    const vector<unsigned char>& maskBlack, bool onLuma, int tolerance);
+vector<unsigned char> getMaskBlack(const PNG& maskImg);
+MatchList selectBestMatches(const ScoreBuffer& scores, int rows,
+    int cols, int maskWidth, int maskHeight, int matchPercent, 
+    const SearchToken& token);
+int reportMatches(PNG& largeImg, const PNG& maskImg, 
+    const MatchList& matches, const string& outImageFile, 
+    const bool writeImage);
 void hitOrMiss(const Pixel& maskPixel, const Pixel& Black, const Pixel& 
     White, bool isSameShade, size_t& hit, size_t& miss);
 int processRegion(const PNG& largeImg, const PNG& maskImg, int row, 
     int col, const Pixel& bgColor, int tolerance);
 void drawBox(PNG& png, int row, int col, int width, int height);
+void drawBoxLuma(PNG::Buffer& luma, int imgWidth, int row, int col, 
+    int width, int height);
+int computeBackgroundLuma(const unsigned char* luma, int imgWidth, 
+    const unsigned char* maskBlack, int maskWidth, int maskHeight, int row, 
+    int col);
+int processRegionLuma(const unsigned char* luma, int imgWidth, 
+    const unsigned char* maskBlack, int maskWidth, int maskHeight, int row, 
+    int col, int bgLuma, int tolerance);
+
+/**
+ * Selects when the search runs on an 8-bit luminance plane instead of the
+ * RGBA pixels of the main image.
+ */
+enum class LumaMode {
+    Off,   ///< Always compare the red, green, and blue channels.
+    Auto,  ///< Use luminance only if the image is grayscale (lossless).
+    On     ///< Always use luminance, even if that is lossy for color images.
+};
+
+/**
+ * Selects how matches are chosen among the windows that exceed the match
+ * threshold.
+ */
+enum class SelectMode {
+    First,  ///< Greedy in row-major order (see acceptMatches()).
+    Best    ///< Best score first among local maxima (see selectBestMatches())
+};
+
+/**
+ * Optional settings for imageSearch() beyond the classic command-line
+ * parameters.
+ */
+struct SearchOptions {
+    /** When to use the single-channel luminance fast path. */
+    LumaMode luminance = LumaMode::Auto;
+    /** How overlapping windows above the threshold are resolved. */
+    SelectMode selection = SelectMode::First;
+    /** If not empty, the score and background of every window are written
+        to this memory-mapped file (see ScoreMap). */
+    string scoreMapFile;
+    /** The storage format of the scores in scoreMapFile. */
+    ScoreMap::Format scoreMapFormat = ScoreMap::Float32;
+    /** If not null, results are looked up in and added to this cache.
+        The cache is bypassed when a score map is requested. */
+    ResultCache* cache = nullptr;
+    /** If true, the NUMA placement of the main image is reported. */
+    bool numaStats = false;
+};
+
+/**
+ * The number of rows of window positions scored by a single task. Small
+ * tiles let searches sharing the TaskPool interleave fairly and let a
+ * cancelled search stop quickly.
+ */
+const int TileRows = 4;
+
+/**
+ * Serializes console output from concurrently running searches so that the
+ * lines of one search are not interleaved with those of another.
+ */
+static std::mutex coutMutex;
 
 /**
  * This is the top-level method that is called from the main method to 
@@ -60,35 +157,202 @@ void drawBox(PNG& png, int row, int col, int width, int height);
  * \param[in] tolerance The absolute acceptable difference between 
  * each color
  * channel when comparing  
+ *
+ * \param[in] options Additional settings (such as luminance mode).
+ *
+ * \param[in] token The cancellation token / deadline for this search.
+ *
+ * \param[out] stats If not null, the scheduling statistics of the scan.
+ *
+ * \returns The number of matches found.
+ *
+ * \throws std::runtime_error If the search was cancelled or ran past its
+ * deadline. In this case no output image is written.
  */
-void imageSearch(const std::string& mainImageFile,
-                 const std::string& srchImageFile, 
-                 const std::string& outImageFile, 
-                 const bool isMask = true, 
-                 const int matchPercent = 75, 
-                 const int tole = 32) {
+int imageSearch(const std::string& mainImageFile,
+                const std::string& srchImageFile, 
+                const std::string& outImageFile, 
+                const bool isMask = true, 
+                const int matchPercent = 75, 
+                const int tole = 32,
+                const SearchOptions& options = SearchOptions(),
+                const SearchToken& token = SearchToken(),
+                SearchStats* stats = nullptr) {
     PNG largeImg, maskImg;
-    largeImg.load(mainImageFile);  
+    // Grayscale PNGs are decoded straight into the luminance plane too.
+    PNG::Buffer luma;
+    bool lumaLoaded = false;
+    if (options.luminance != LumaMode::Off) {
+        lumaLoaded = largeImg.load(mainImageFile, luma);
+    } else {
+        largeImg.load(mainImageFile);
+    }
     maskImg.load(srchImageFile);
-    vector<pair<int, int>> matchedRegions;
-
-for (int row = 0; row <= largeImg.getHeight() - maskImg.getHeight(); ++row) {
-    for (int col = 0; col <= largeImg.getWidth() - maskImg.getWidth(); ++col) {
-    Pixel bgColor = computeBackgroundPixel(largeImg, maskImg, row, col, 
-    maskImg.getHeight(), maskImg.getWidth());
-    int netMatch = processRegion(largeImg, maskImg, row, col, bgColor, tole);
-    if (netMatch > maskImg.getWidth() * maskImg.getHeight() * 
-    matchPercent / 100 &&!isOverlapping(matchedRegions, row, col, maskImg)) {
-    std::cout << "sub-image matched at: " << row << ", " << col << ", "<< row + 
-    maskImg.getHeight() << ", " << col + maskImg.getWidth() << std::endl;
-                drawBox(largeImg, row, col, maskImg.getWidth(), 
-                     maskImg.getHeight());
-                     matchedRegions.push_back({row, col});
+    // Repeated queries are answered from the cache without a scan.
+    string cacheKey;
+    if (options.cache != nullptr && options.scoreMapFile.empty()) {
+        cacheKey = options.cache->makeKey(largeImg, maskImg, {isMask, 
+            matchPercent, tole, options.luminance == LumaMode::On, 
+            static_cast<int>(options.selection)});
+        MatchList cached;
+        if (options.cache->lookup(cacheKey, cached)) {
+            const bool haveImage = options.cache->copyImage(cacheKey, 
+                                                            outImageFile);
+            const int numMatches = reportMatches(largeImg, maskImg, cached,
+                                                 outImageFile, !haveImage);
+            if (!haveImage) {
+                // The image was evicted; keep the regenerated one.
+                options.cache->storeImage(cacheKey, outImageFile);
+            }
+            return numMatches;
+        }
+    }
+    // Convert the main image to a luminance plane if requested. With
+    // R = G = B the single-channel comparisons give identical results.
+    // The conversion runs in the same row bands as the scan below.
+    vector<unsigned char> maskBlack;
+    bool useLuma = lumaLoaded;
+    if (options.luminance != LumaMode::Off && !lumaLoaded) {
+        std::atomic<bool> lossless{true};
+        luma.resize(largeImg.getWidth() * largeImg.getHeight());
+        TaskPool::shared().parallelFor(largeImg.getHeight(), TileRows, 
+            [&](int begin, int end) {
+                if (!largeImg.getLuminance(luma.data(), begin, end)) {
+                    lossless = false;
+                }
+            }, token, true);
+        useLuma = lossless || (options.luminance == LumaMode::On);
+    }
+    if (useLuma) {
+        maskBlack = getMaskBlack(maskImg);
+    }
+
+    // Score every window position in parallel on the unmodified image.
+    // Each task handles a tile of TileRows rows of window positions.
+    const int rows = std::max(0, largeImg.getHeight() - maskImg.getHeight() + 1);
+    const int cols = std::max(0, largeImg.getWidth() - maskImg.getWidth() + 1);
+    ScoreBuffer scores(static_cast<size_t>(rows) * cols);
+    ScoreMap scoreMap;
+    if (!options.scoreMapFile.empty()) {
+        scoreMap.create(options.scoreMapFile, rows, cols, maskImg.getWidth(),
+                        maskImg.getHeight(), options.scoreMapFormat, tole,
+                        static_cast<uint32_t>(options.luminance),
+                        ScoreMap::hashImages(largeImg, maskImg));
+    }
+    const auto scoreRows = [&](int begin, int end) {
+        for (int row = begin; row < end && !token.isCancelled(); ++row) {
+            int* const rowScores = &scores[static_cast<size_t>(row) * cols];
+            if (useLuma) {
+                for (int col = 0; col < cols; ++col) {
+                    const int bg = computeBackgroundLuma(luma.data(), 
+                        largeImg.getWidth(), maskBlack.data(), 
+                        maskImg.getWidth(), maskImg.getHeight(), row, col);
+                    rowScores[col] = processRegionLuma(luma.data(), 
+                        largeImg.getWidth(), maskBlack.data(), 
+                        maskImg.getWidth(), maskImg.getHeight(), row, col, bg,
+                        tole);
+                    if (scoreMap.isOpen()) {
+                        scoreMap.set(row, col, rowScores[col], bg * 0x01'01'01U);
+                    }
+                }
+                continue;
             }
+            for (int col = 0; col < cols; ++col) {
+                Pixel bgColor = computeBackgroundPixel(largeImg, maskImg, row,
+                    col, maskImg.getHeight(), maskImg.getWidth());
+                rowScores[col] = processRegion(largeImg, maskImg, row, col, 
+                                               bgColor, tole);
+                if (scoreMap.isOpen()) {
+                    scoreMap.set(row, col, rowScores[col], bgColor.rgba);
+                }
+            }
+        }
+    };
+    const SearchStats scan = TaskPool::shared().parallelFor(rows, TileRows,
+                                                            scoreRows, token,
+                                                            true);
+    if (stats != nullptr) {
+        *stats = scan;
+    }
+    const auto checkCancelled = [&](const bool skippedTiles) {
+        if (skippedTiles || token.isCancelled()) {
+            throw std::runtime_error("Search for " + srchImageFile + " in " +
+                                     mainImageFile + " was cancelled");
         }
+    };
+    checkCancelled(scan.cancelled);
+    if (scoreMap.isOpen()) {
+        scoreMap.finish();
     }
-    largeImg.write(outImageFile);
-    std::cout << "Number of matches: " << matchedRegions.size() << std::endl;}
+
+    if (options.numaStats) {
+        const auto& topology = NumaTopology::get();
+        const auto& buffer   = largeImg.getBuffer();
+        const auto imgPages  = topology.pagesPerNode(buffer.data(), 
+                                                     buffer.size());
+        const auto lumaPages = topology.pagesPerNode(luma.data(), luma.size());
+        std::lock_guard<std::mutex> guard(coutMutex);
+        for (int node = 0; node < topology.getNumNodes(); node++) {
+            std::cout << "Node " << node << ": image pages " 
+                      << imgPages[node] << ", luminance pages " 
+                      << lumaPages[node] << std::endl;
+        }
+    }
+
+    // Windows next to an accepted match are re-scored with the boxes of
+    // the matches accepted so far drawn into the image, as a serial search
+    // would see them. With --luminance=on the boxes are also drawn into
+    // the luminance plane and windows are re-scored on it.
+    const RescoreFn rescore = makeRescore(largeImg, maskImg, luma, maskBlack,
+        useLuma && (options.luminance == LumaMode::On), tole);
+    // Accept matches greedily in row-major order or by best score.
+    const auto matchedRegions = (options.selection == SelectMode::Best) ?
+        selectBestMatches(scores, rows, cols, maskImg.getWidth(), 
+                          maskImg.getHeight(), matchPercent, token) :
+        acceptMatches(scores, rows, cols, maskImg.getWidth(), 
+                      maskImg.getHeight(), matchPercent, rescore);
+    checkCancelled(false);
+    reportMatches(largeImg, maskImg, matchedRegions, outImageFile, true);
+    if (!cacheKey.empty()) {
+        options.cache->store(cacheKey, matchedRegions, outImageFile);
+    }
+    return matchedRegions.size();
+}
+
+/**
+ * Prints the matches of a search and, optionally, writes the main image
+ * with a box drawn around each match.
+ * 
+ * \param[in,out] largeImg The main image in which the boxes are drawn.
+ * \param[in] maskImg The sub-image mask used for matching.
+ * \param[in] matches The top-left corners (row, col) of the matches.
+ * \param[in] outImageFile The output file for the annotated image.
+ * \param[in] writeImage If false, the boxes are not drawn and the image
+ * is not written (for example, because a cached copy has been used).
+ * 
+ * \returns The number of matches.
+ */
+int reportMatches(PNG& largeImg, const PNG& maskImg, 
+                  const MatchList& matches, 
+                  const string& outImageFile, const bool writeImage) {
+    std::ostringstream log;
+    for (const auto& [row, col] : matches) {
+        log << "sub-image matched at: " << row << ", " << col << ", "
+            << row + maskImg.getHeight() << ", "
+            << col + maskImg.getWidth() << std::endl;
+        if (writeImage) {
+            drawBox(largeImg, row, col, maskImg.getWidth(), 
+                    maskImg.getHeight());
+        }
+    }
+    if (writeImage) {
+        largeImg.write(outImageFile);
+    }
+    log << "Number of matches: " << matches.size() << std::endl;
+    std::lock_guard<std::mutex> guard(coutMutex);
+    std::cout << log.str();
+    return matches.size();
+}
 
 /**
  * Processes a region of the image, compares pixel values, and calculates the net match score.
@@ -128,6 +392,76 @@ int processRegion(const PNG& largeImg, const PNG& maskImg, int row, int col,
     return hit - miss;
 }
 
+/**
+ * Computes the average luminance of the main image under the black pixels
+ * of the mask. This is the single-channel counterpart of
+ * computeBackgroundPixel().
+ * 
+ * \param[in] luma The luminance plane of the main image.
+ * \param[in] imgWidth The width of the main image.
+ * \param[in] maskBlack One byte per mask pixel, 1 if the pixel is black.
+ * \param[in] maskWidth The width of the mask.
+ * \param[in] maskHeight The height of the mask.
+ * \param[in] row The starting row of the region.
+ * \param[in] col The starting column of the region.
+ * 
+ * \returns The average background luminance (truncated).
+ */
+int computeBackgroundLuma(const unsigned char* luma, int imgWidth, 
+                          const unsigned char* maskBlack, int maskWidth, 
+                          int maskHeight, int row, int col) {
+    int sum = 0, count = 0;
+    for (int maskRow = 0; maskRow < maskHeight; ++maskRow) {
+        const unsigned char* pix = luma + (row + maskRow) * imgWidth + col;
+        const unsigned char* blk = maskBlack + maskRow * maskWidth;
+        for (int maskCol = 0; maskCol < maskWidth; ++maskCol) {
+            sum   += blk[maskCol] ? pix[maskCol] : 0;
+            count += blk[maskCol];
+        }
+    }
+    return (count > 0) ? sum / count : 0;
+}
+
+/**
+ * Single-channel version of processRegion() that operates on a luminance
+ * plane. The inner loop works on bytes only, so the compiler can
+ * vectorize it to compare many pixels per instruction.
+ * 
+ * \param[in] luma The luminance plane of the main image.
+ * \param[in] imgWidth The width of the main image.
+ * \param[in] maskBlack One byte per mask pixel, 1 if the pixel is black.
+ * \param[in] maskWidth The width of the mask.
+ * \param[in] maskHeight The height of the mask.
+ * \param[in] row The starting row of the region.
+ * \param[in] col The starting column of the region.
+ * \param[in] bgLuma The background luminance of the region.
+ * \param[in] tolerance The tolerance for pixel comparison.
+ * 
+ * \returns The difference between hit and miss counts in the region.
+ */
+int processRegionLuma(const unsigned char* luma, int imgWidth, 
+                      const unsigned char* maskBlack, int maskWidth, 
+                      int maskHeight, int row, int col, int bgLuma, 
+                      int tolerance) {
+    // |pix - bg| < tolerance with all values as bytes. A tolerance above
+    // 255 matches everything and one at or below 0 matches nothing.
+    const unsigned char bg  = bgLuma;
+    const unsigned char tol = std::clamp(tolerance, 0, 255);
+    const unsigned char all = (tolerance > 255);
+    int hit = 0;
+    for (int maskRow = 0; maskRow < maskHeight; ++maskRow) {
+        const unsigned char* pix = luma + (row + maskRow) * imgWidth + col;
+        const unsigned char* blk = maskBlack + maskRow * maskWidth;
+        for (int maskCol = 0; maskCol < maskWidth; ++maskCol) {
+            const unsigned char p    = pix[maskCol];
+            const unsigned char diff = (p > bg) ? p - bg : bg - p;
+            const unsigned char same = (diff < tol) | all;
+            hit += (same == blk[maskCol]);
+        }
+    }
+    return 2 * hit - maskWidth * maskHeight;
+}
+
 /**
  * Checks if a given pixel is close to white within a certain tolerance.
  * 
@@ -182,27 +516,602 @@ void drawBox(PNG& png, int row, int col, int width, int height) {
     }
 }
 
+/**
+ * Draws the box of drawBox() into a luminance plane, using the luminance
+ * of a red pixel. Pixels are addressed like drawBox() does, so a box at the
+ * right edge wraps into the next row; pixels past the end are skipped.
+ * 
+ * \param[out] luma The luminance plane to be modified.
+ * \param[in] imgWidth The width of the main image.
+ * \param[in] row The starting row of the box.
+ * \param[in] col The starting column of the box.
+ * \param[in] width The width of the box.
+ * \param[in] height The height of the box.
+ */
+void drawBoxLuma(PNG::Buffer& luma, int imgWidth, int row, int col, 
+                 int width, int height) {
+    // Y of (255, 0, 0) as computed by PNG::getLuminance().
+    const unsigned char RedLuma = (77 * 255 + 128) >> 8;
+    const auto setRed = [&](int r, int c) {
+        const size_t idx = static_cast<size_t>(r) * imgWidth + c;
+        if (idx < luma.size()) {
+            luma[idx] = RedLuma;
+        }
+    };
+    for (int i = 0; i < width; i++) {
+        setRed(row, col + i);
+        setRed(row + height, col + i);
+    }
+    for (int i = 0; i < height; i++) { 
+        setRed(row + i, col);
+        setRed(row + i, col + width);
+    }
+}
+
 /**
  * Checks if a region overlaps with any previously matched regions.
  * 
  * \param[in] regions The vector of previously matched regions.
  * \param[in] row The current row of the region.
  * \param[in] col The current column of the region.
- * \param[in] maskImg The sub-image mask used for matching.
+ * \param[in] maskWidth The width of the sub-image mask used for matching.
+ * \param[in] maskHeight The height of the sub-image mask.
  * 
  * \returns True if the region overlaps, false otherwise.
  */
-bool isOverlapping(const vector<pair<int, int>>& regions, int row, int col, 
-                   const PNG& maskImg) {
+bool isOverlapping(const MatchList& regions, int row, int col, 
+                   int maskWidth, int maskHeight) {
     for (const auto& region : regions) {
-        if (abs(region.first - row) < maskImg.getHeight() && 
-            abs(region.second - col) < maskImg.getWidth()) {
+        if (abs(region.first - row) < maskHeight && 
+            abs(region.second - col) < maskWidth) {
             return true;
         }
     }
     return false;
 }
 
+/**
+ * Minimum size of a buffer for it to be first-touched in parallel. Smaller
+ * buffers, such as masks, are cleared by the calling thread.
+ */
+const int FirstTouchMinBytes = 1 << 20;
+
+/**
+ * First-touches (zero-fills) a new pixel buffer in row bands on the shared
+ * TaskPool. The bands match those used by the scan in imageSearch(), so the
+ * pages of each band are placed on the NUMA node of the worker that later
+ * scans it. Installed via PNG::setFirstTouch() when --numa is given.
+ * 
+ * \param[out] buffer The start of the buffer.
+ * \param[in] rowBytes The number of bytes per row.
+ * \param[in] rows The number of rows.
+ */
+void firstTouchRows(unsigned char* buffer, int rowBytes, int rows) {
+    if (rowBytes * rows < FirstTouchMinBytes) {
+        std::fill_n(buffer, rowBytes * rows, 0);
+        return;
+    }
+    static const SearchToken noDeadline;
+    TaskPool::shared().parallelFor(rows, TileRows, [=](int begin, int end) {
+        std::fill(buffer + begin * rowBytes, buffer + end * rowBytes, 0);
+    }, noDeadline, true);
+}
+
+/**
+ * Prints, for each NUMA node, the number of pool workers running on it and
+ * the number of tiles they have executed.
+ */
+void printNumaStats() {
+    const auto& topology = NumaTopology::get();
+    const TaskPool& pool = TaskPool::shared();
+    vector<size_t> workers(topology.getNumNodes()), tiles(workers.size());
+    for (int i = 0; i < pool.getNumThreads(); i++) {
+        const int node = topology.nodeOfCpu(pool.getWorkerCpu(i));
+        workers[node]++;
+        tiles[node] += pool.getTilesRun(i);
+    }
+    for (int node = 0; node < topology.getNumNodes(); node++) {
+        std::cout << "Node " << node << ": " << topology.cpusOfNode(node).size()
+                  << " cpus, " << workers[node] << " workers, " 
+                  << tiles[node] << " tiles run" << std::endl;
+    }
+}
+
+/**
+ * Prints the number of buffer allocations made by the BufferPool and the
+ * number (and size) of allocations avoided by reusing pooled buffers.
+ */
+void printPoolStats() {
+    const BufferPool& pool = BufferPool::instance();
+    std::cout << "Buffer pool: " << pool.getAllocations() << " allocations ("
+              << (pool.getAllocatedBytes() >> 10) << " KiB), "
+              << pool.getReuses() << " reused ("
+              << (pool.getReusedBytes() >> 10) << " KiB), "
+              << (pool.getCachedBytes() >> 10) << " KiB cached" << std::endl;
+}
+
+/**
+ * Splits the command-line arguments into "--name=value" options and
+ * positional arguments. An option without a value is recorded as "true".
+ *
+ * \param[in] argc The number of command-line arguments.
+ * \param[in] argv The command-line arguments.
+ * \param[out] positional The non-option arguments, including argv[0].
+ *
+ * \returns The options keyed by name (without the leading "--").
+ */
+unordered_map<string, string> parseOptions(int argc, char* argv[],
+                                           vector<string>& positional) {
+    unordered_map<string, string> options;
+    for (int i = 0; i < argc; i++) {
+        const string arg = argv[i];
+        if (i > 0 && arg.rfind("--", 0) == 0) {
+            const auto eq = arg.find('=');
+            options[arg.substr(2, eq - 2)] = (eq == string::npos) ? "true" : 
+                arg.substr(eq + 1);
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    return options;
+}
+
+/**
+ * Runs several searches concurrently on the shared TaskPool and reports the
+ * latency of each search along with the peak queue depth of the pool. Each
+ * non-empty line of the batch file that does not start with '#' has the
+ * form:
+ *
+ *   MainPNGfile SearchPNGfile OutputPNGfile [isMask] [percent] [tolerance]
+ *   [deadline-ms]
+ *
+ * \param[in] batchFile The file listing the searches to run.
+ * \param[in] defaultDeadlineMs The deadline used for lines that do not
+ * specify one. Zero means no deadline.
+ * \param[in] options The settings shared by all searches in the batch.
+ *
+ * \returns 0 if all searches completed, 1 otherwise.
+ */
+int runBatch(const string& batchFile, const int defaultDeadlineMs,
+             const SearchOptions& options) {
+    std::ifstream in(batchFile);
+    if (!in) {
+        std::cerr << "Unable to read batch file " << batchFile << std::endl;
+        return 1;
+    }
+    struct Query {
+        string mainFile, srchFile, outFile;
+        bool isMask = true;
+        int percent = 75, tolerance = 32, deadlineMs = 0;
+        int matches = -1;
+        double totalMs = 0;
+        SearchStats stats;
+        string error;
+    };
+    vector<Query> queries;
+    for (string line; std::getline(in, line);) {
+        std::istringstream is(line);
+        Query q;
+        string mask = "true";
+        if (line.empty() || line[0] == '#' || 
+            !(is >> q.mainFile >> q.srchFile >> q.outFile)) {
+            continue;
+        }
+        q.deadlineMs = defaultDeadlineMs;
+        is >> mask >> q.percent >> q.tolerance >> q.deadlineMs;
+        q.isMask = (mask == "true");
+        queries.push_back(q);
+    }
+
+    using Ms = std::chrono::duration<double, std::milli>;
+    vector<std::thread> callers;
+    for (size_t i = 0; i < queries.size(); i++) {
+        // Give each search its own score map file, if one was requested.
+        SearchOptions queryOptions = options;
+        if (!options.scoreMapFile.empty()) {
+            queryOptions.scoreMapFile += "." + std::to_string(i);
+        }
+        callers.emplace_back([&q = queries[i], queryOptions] {
+            const auto start = std::chrono::steady_clock::now();
+            const SearchToken token(std::chrono::milliseconds(q.deadlineMs));
+            try {
+                q.matches = imageSearch(q.mainFile, q.srchFile, q.outFile,
+                                        q.isMask, q.percent, q.tolerance,
+                                        queryOptions, token, &q.stats);
+            } catch (const std::exception& e) {
+                q.error = e.what();
+            }
+            q.totalMs = Ms(std::chrono::steady_clock::now() - start).count();
+        });
+    }
+    for (auto& caller : callers) {
+        caller.join();
+    }
+
+    int status = 0;
+    const TaskPool& pool = TaskPool::shared();
+    std::cout << "Batch of " << queries.size() << " searches on "
+              << pool.getNumThreads() << " threads, peak queue depth: "
+              << pool.maxQueueDepth() << " tiles\n";
+    for (const auto& q : queries) {
+        std::cout << q.srchFile << " in " << q.mainFile << ": " << std::fixed
+                  << std::setprecision(1) << "latency " << q.totalMs 
+                  << " ms, scan " << q.stats.latencyMs << " ms, queued "
+                  << q.stats.queueMs << " ms, tiles " << q.stats.tilesRun;
+        if (q.error.empty()) {
+            std::cout << ", matches " << q.matches << '\n';
+        } else {
+            std::cout << ", skipped " << q.stats.tilesSkipped << ", error: "
+                      << q.error << '\n';
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/**
+ * Returns one byte per mask pixel, 1 if the pixel is black. This is the
+ * form of the mask used by the luminance functions.
+ * 
+ * \param[in] maskImg The sub-image mask used for matching.
+ */
+vector<unsigned char> getMaskBlack(const PNG& maskImg) {
+    const Pixel Black{ .rgba = 0xff'00'00'00U };
+    vector<unsigned char> maskBlack(maskImg.getWidth() * maskImg.getHeight());
+    for (int mRow = 0; mRow < maskImg.getHeight(); ++mRow) {
+        for (int mCol = 0; mCol < maskImg.getWidth(); ++mCol) {
+            maskBlack[mRow * maskImg.getWidth() + mCol] = 
+                (maskImg.getPixel(mRow, mCol).rgba == Black.rgba);
+        }
+    }
+    return maskBlack;
+}
+
+/**
+ * Creates the rescore callback of acceptMatches(). Before scoring a
+ * window, the callback draws the boxes of the matches accepted since its
+ * last call into the main image (and, if onLuma is true, into the
+ * luminance plane), so that windows are scored as a serial search would
+ * see them.
+ * 
+ * \param[in,out] largeImg The main image; boxes are drawn into it.
+ * \param[in] maskImg The sub-image mask used for matching.
+ * \param[in,out] luma The luminance plane of the main image. Only used if
+ * onLuma is true.
+ * \param[in] maskBlack The getMaskBlack() bytes of the mask. Only used if
+ * onLuma is true.
+ * \param[in] onLuma If true, windows are scored on the luminance plane
+ * (--luminance=on), otherwise on the RGBA pixels.
+ * \param[in] tolerance The tolerance for pixel comparison.
+ * 
+ * \returns The callback. It refers to the given objects, which must
+ * outlive it.
+ */
+RescoreFn makeRescore(PNG& largeImg, const PNG& maskImg, PNG::Buffer& luma,
+                      const vector<unsigned char>& maskBlack, bool onLuma, 
+                      int tolerance) {
+    return [&, onLuma, tolerance, boxesDrawn = size_t(0)](
+        const MatchList& accepted, int row, int col) mutable {
+        for (; boxesDrawn < accepted.size(); boxesDrawn++) {
+            const auto& [mRow, mCol] = accepted[boxesDrawn];
+            drawBox(largeImg, mRow, mCol, maskImg.getWidth(), 
+                    maskImg.getHeight());
+            if (onLuma) {
+                drawBoxLuma(luma, largeImg.getWidth(), mRow, mCol, 
+                            maskImg.getWidth(), maskImg.getHeight());
+            }
+        }
+        if (onLuma) {
+            const int bg = computeBackgroundLuma(luma.data(), 
+                largeImg.getWidth(), maskBlack.data(), maskImg.getWidth(), 
+                maskImg.getHeight(), row, col);
+            return processRegionLuma(luma.data(), largeImg.getWidth(), 
+                maskBlack.data(), maskImg.getWidth(), maskImg.getHeight(), 
+                row, col, bg, tolerance);
+        }
+        const Pixel bgColor = computeBackgroundPixel(largeImg, maskImg, row, 
+            col, maskImg.getHeight(), maskImg.getWidth());
+        return processRegion(largeImg, maskImg, row, col, bgColor, tolerance);
+    };
+}
+
+/**
+ * Selects matches from the scores of all window positions. Windows are
+ * visited in row-major order and a window is accepted if its score exceeds
+ * the threshold and it does not overlap a previously accepted window.
+ *
+ * The scores are computed on the unmodified image, whereas a serial search
+ * draws the box of each accepted match into the image before scoring the
+ * windows that follow it. drawBox() paints one pixel past the mask on the
+ * right and bottom (and, for a match in the last column, wraps into the
+ * first column of the next rows), so the windows just right of and below a
+ * match see its box. Such windows are re-scored by the rescore callback,
+ * which gives exactly the result of the serial search. Windows overlapping
+ * an accepted match are rejected regardless of their score and are never
+ * re-scored.
+ * 
+ * \param[in] scores The processRegion() score of each window, row-major.
+ * \param[in] rows The number of window positions vertically.
+ * \param[in] cols The number of window positions horizontally.
+ * \param[in] maskWidth The width of the mask.
+ * \param[in] maskHeight The height of the mask.
+ * \param[in] matchPercent The percentage of pixels that must match.
+ * \param[in] rescore Scores a window with the boxes of the accepted
+ * matches drawn. If empty, the given scores are used for all windows.
+ * 
+ * \returns The top-left corners (row, col) of the accepted windows.
+ */
+MatchList acceptMatches(const ScoreBuffer& scores, int rows, int cols, 
+                        int maskWidth, int maskHeight, int matchPercent,
+                        const RescoreFn& rescore) {
+    MatchList matchedRegions;
+    const int threshold = maskWidth * maskHeight * matchPercent / 100;
+    // One byte per window, set if its footprint touches a drawn box.
+    vector<unsigned char> touched(rescore ? static_cast<size_t>(rows) * 
+                                  cols : 0);
+    const auto markTouched = [&](int row0, int row1, int col0, int col1) {
+        row0 = std::max(row0, 0), row1 = std::min(row1, rows - 1);
+        col0 = std::max(col0, 0), col1 = std::min(col1, cols - 1);
+        for (int row = row0; row <= row1 && col0 <= col1; ++row) {
+            std::fill_n(&touched[static_cast<size_t>(row) * cols + col0],
+                        col1 - col0 + 1, 1);
+        }
+    };
+    for (int row = 0; row < rows; ++row) {
+        for (int col = 0; col < cols; ++col) {
+            if (isOverlapping(matchedRegions, row, col, maskWidth, 
+                              maskHeight)) {
+                continue;
+            }
+            const size_t idx   = static_cast<size_t>(row) * cols + col;
+            const int netMatch = (rescore && touched[idx]) ? 
+                rescore(matchedRegions, row, col) : scores[idx];
+            if (netMatch > threshold) {
+                matchedRegions.push_back({row, col});
+                if (rescore) {
+                    // The box covers rows row..row+maskHeight and columns
+                    // col..col+maskWidth of the image.
+                    markTouched(row - maskHeight + 1, row + maskHeight, 
+                                col - maskWidth + 1, col + maskWidth);
+                    if (col == cols - 1) {
+                        // Right edge wrapped to column 0 of the next rows.
+                        markTouched(row - maskHeight + 2, row + maskHeight,
+                                    0, 0);
+                    }
+                }
+            }
+        }
+    }
+    return matchedRegions;
+}
+
+/**
+ * Selects matches from the scores of all window positions by score rather
+ * than by position. Windows are ranked by score (ties broken in row-major
+ * order). First, the windows above the threshold that outrank their 8
+ * neighbors are found in parallel. Then overlaps among these local maxima
+ * are resolved by a parallel non-maximum suppression: in each round, a
+ * candidate is kept if every higher-ranked candidate overlapping it has
+ * been suppressed, and suppressed if one of them has been kept. This gives
+ * exactly the result of the sequential greedy-by-score selection, but each
+ * round runs in parallel and usually only a few rounds are needed.
+ * 
+ * \param[in] scores The processRegion() score of each window, row-major.
+ * \param[in] rows The number of window positions vertically.
+ * \param[in] cols The number of window positions horizontally.
+ * \param[in] maskWidth The width of the mask.
+ * \param[in] maskHeight The height of the mask.
+ * \param[in] matchPercent The percentage of pixels that must match.
+ * \param[in] token The cancellation token of the search.
+ * 
+ * \returns The top-left corners (row, col) of the accepted windows in
+ * row-major order.
+ */
+MatchList selectBestMatches(const ScoreBuffer& scores, int rows, int cols,
+                            int maskWidth, int maskHeight, int matchPercent,
+                            const SearchToken& token) {
+    TaskPool& pool = TaskPool::shared();
+    const int threshold = maskWidth * maskHeight * matchPercent / 100;
+    const auto score = [&](int row, int col) {
+        return scores[static_cast<size_t>(row) * cols + col];
+    };
+    // True if window a = (row, col) outranks window b.
+    const auto outranks = [&](int rowA, int colA, int rowB, int colB) {
+        const int scoreA = score(rowA, colA), scoreB = score(rowB, colB);
+        return (scoreA != scoreB) ? (scoreA > scoreB) : 
+            (std::make_pair(rowA, colA) < std::make_pair(rowB, colB));
+    };
+
+    // Find the local maxima above the threshold, one list per row.
+    vector<vector<int>> rowMaxima(std::max(rows, 0));
+    pool.parallelFor(rows, TileRows, [&](int begin, int end) {
+        for (int row = begin; row < end; ++row) {
+            for (int col = 0; col < cols; ++col) {
+                if (score(row, col) <= threshold) {
+                    continue;
+                }
+                bool isMax = true;
+                for (int r = std::max(0, row - 1); 
+                     r <= std::min(rows - 1, row + 1) && isMax; ++r) {
+                    for (int c = std::max(0, col - 1); 
+                         c <= std::min(cols - 1, col + 1) && isMax; ++c) {
+                        isMax = (r == row && c == col) || 
+                            outranks(row, col, r, c);
+                    }
+                }
+                if (isMax) {
+                    rowMaxima[row].push_back(col);
+                }
+            }
+        }
+    }, token, true);
+
+    // Rank the candidates, best first.
+    MatchList cands;
+    for (int row = 0; row < rows; ++row) {
+        for (const int col : rowMaxima[row]) {
+            cands.push_back({row, col});
+        }
+    }
+    std::sort(cands.begin(), cands.end(), [&](const auto& a, const auto& b) {
+        return outranks(a.first, a.second, b.first, b.second);
+    });
+    const int numCands = cands.size();
+
+    // Bucket the candidates into a grid of mask-sized cells so that only
+    // the 3 x 3 neighboring cells need to be checked for overlaps.
+    const int cellCols = cols / maskWidth + 1;
+    const int numCells = (rows / maskHeight + 1) * cellCols;
+    const auto cellOf = [&](int row, int col) {
+        return (row / maskHeight) * cellCols + col / maskWidth;
+    };
+    vector<int> cellStart(numCells + 1), cellCands(numCands);
+    for (const auto& [row, col] : cands) {
+        cellStart[cellOf(row, col) + 1]++;
+    }
+    std::partial_sum(cellStart.begin(), cellStart.end(), cellStart.begin());
+    vector<int> cellFill(cellStart.begin(), cellStart.end() - 1);
+    for (int i = 0; i < numCands; ++i) {
+        cellCands[cellFill[cellOf(cands[i].first, cands[i].second)]++] = i;
+    }
+
+    // For each candidate, the higher-ranked candidates that overlap it.
+    vector<vector<int>> rivals(numCands);
+    pool.parallelFor(numCands, 64, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            const auto [row, col] = cands[i];
+            for (int cr = row / maskHeight - 1; cr <= row / maskHeight + 1; 
+                 ++cr) {
+                for (int cc = col / maskWidth - 1; cc <= col / maskWidth + 1;
+                     ++cc) {
+                    if (cr < 0 || cc < 0 || cc >= cellCols || 
+                        (cr * cellCols + cc) >= numCells) {
+                        continue;
+                    }
+                    const int cell = cr * cellCols + cc;
+                    for (int k = cellStart[cell]; k < cellStart[cell + 1]; 
+                         ++k) {
+                        const int j = cellCands[k];
+                        if (j < i && abs(cands[j].first - row) < maskHeight &&
+                            abs(cands[j].second - col) < maskWidth) {
+                            rivals[i].push_back(j);
+                        }
+                    }
+                }
+            }
+        }
+    }, token);
+
+    // Resolve overlaps in rounds until every candidate is decided. Each
+    // round decides at least the best undecided candidate.
+    enum : unsigned char { Undecided, Kept, Suppressed };
+    vector<std::atomic<unsigned char>> state(numCands);
+    for (std::atomic<bool> changed{true}; changed && !token.isCancelled();) {
+        changed = false;
+        pool.parallelFor(numCands, 256, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                if (state[i] != Undecided) {
+                    continue;
+                }
+                bool allSuppressed = true, rivalKept = false;
+                for (const int j : rivals[i]) {
+                    rivalKept     = rivalKept || (state[j] == Kept);
+                    allSuppressed = allSuppressed && (state[j] == Suppressed);
+                }
+                if (rivalKept || allSuppressed) {
+                    state[i] = rivalKept ? Suppressed : Kept;
+                    changed  = true;
+                }
+            }
+        }, token);
+    }
+
+    MatchList matchedRegions;
+    for (int i = 0; i < numCands; ++i) {
+        if (state[i] == Kept) {
+            matchedRegions.push_back(cands[i]);
+        }
+    }
+    std::sort(matchedRegions.begin(), matchedRegions.end());
+    return matchedRegions;
+}
+
+/**
+ * Lists the matches recorded in a score map file for a given match
+ * percentage without repeating the scan. The output has the same format
+ * as imageSearch().
+ *
+ * The map holds the scores of the unmodified image, whereas the default
+ * (first) selection re-scores the windows next to each accepted match
+ * with its box drawn (see acceptMatches()). If the main and search images
+ * are given, these windows are re-scored in the same way, giving exactly
+ * the matches of imageSearch(). Otherwise the stored scores are used and
+ * matches next to boxes typically differ, so a warning is printed.
+ * 
+ * \param[in] scoreMapFile The score map written by an earlier search.
+ * \param[in] matchPercent The percentage of pixels that must match.
+ * \param[in] selection How overlapping windows are resolved.
+ * \param[in] mainImageFile The main image of the search that wrote the
+ * map, or an empty string.
+ * \param[in] srchImageFile The search image of that search, or an empty
+ * string.
+ * 
+ * \returns The number of matches.
+ *
+ * \throws std::runtime_error If the images are not those the map was
+ * computed from.
+ */
+int thresholdScoreMap(const string& scoreMapFile, const int matchPercent,
+                      const SelectMode selection, 
+                      const string& mainImageFile = "", 
+                      const string& srchImageFile = "") {
+    ScoreMap scoreMap;
+    scoreMap.open(scoreMapFile);
+    ScoreBuffer scores(static_cast<size_t>(scoreMap.getRows()) * 
+                       scoreMap.getCols());
+    scoreMap.getScores(scores.data());
+    const int maskWidth = scoreMap.getMaskWidth();
+    const int maskHeight = scoreMap.getMaskHeight();
+    // Set up re-scoring with the images the map was computed from.
+    PNG largeImg, maskImg;
+    PNG::Buffer luma;
+    vector<unsigned char> maskBlack;
+    RescoreFn rescore;
+    if (selection == SelectMode::First && !mainImageFile.empty()) {
+        largeImg.load(mainImageFile);
+        maskImg.load(srchImageFile);
+        if (ScoreMap::hashImages(largeImg, maskImg) != 
+            scoreMap.getImageHash()) {
+            throw std::runtime_error("Score map " + scoreMapFile + " was not "
+                                     "computed from " + mainImageFile + 
+                                     " and " + srchImageFile);
+        }
+        const bool onLuma = (scoreMap.getLuminance() == 
+                             static_cast<uint32_t>(LumaMode::On));
+        if (onLuma) {
+            largeImg.getLuminance(luma);
+            maskBlack = getMaskBlack(maskImg);
+        }
+        rescore = makeRescore(largeImg, maskImg, luma, maskBlack, onLuma, 
+                              scoreMap.getTolerance());
+    } else if (selection == SelectMode::First) {
+        std::cerr << "Warning: windows next to matches are not re-scored "
+                  << "without the main and search images; matches may "
+                  << "differ from the search that wrote the map\n";
+    }
+    const auto matchedRegions = (selection == SelectMode::Best) ?
+        selectBestMatches(scores, scoreMap.getRows(), scoreMap.getCols(), 
+                          maskWidth, maskHeight, matchPercent, SearchToken()) :
+        acceptMatches(scores, scoreMap.getRows(), scoreMap.getCols(), 
+                      maskWidth, maskHeight, matchPercent, rescore);
+    for (const auto& [row, col] : matchedRegions) {
+        std::cout << "sub-image matched at: " << row << ", " << col << ", "
+                  << row + maskHeight << ", " << col + maskWidth << std::endl;
+    }
+    std::cout << "Number of matches: " << matchedRegions.size() << std::endl;
+    return matchedRegions.size();
+}
+
 /**
  * Main function to check command-line arguments and invoke image search.
  * 
@@ -212,19 +1121,110 @@ bool isOverlapping(const vector<pair<int, int>>& regions, int row, int col,
  * \returns 0 if the process was successful, 1 otherwise.
  */
 int main(int argc, char* argv[]) {
-    if (argc < 4) {
-        std::cout << "Usage: " << argv[0] << " <MainPNGfile> <SearchPNGfile> "
-                  << "<OutputPNGfile> [isMaskFlag] [match-percentage] "
-                  << "[tolerance]\n";
+    vector<string> args;
+    auto options = parseOptions(argc, argv, args);
+    TaskPool& pool = TaskPool::shared(options.count("threads") ? 
+                                      std::stoi(options["threads"]) : 0);
+    if (options.count("pin") && options["pin"] != "none") {
+        const auto cpus = NumaTopology::get().cpuOrder(options["pin"] == 
+                                                       "scatter");
+        if (!pool.pinWorkers(cpus)) {
+            std::cerr << "Warning: unable to pin all worker threads\n";
+        }
+    }
+    if (options.count("numa")) {
+        // Reused blocks would keep the placement of an earlier search.
+        PNG::setFirstTouch(firstTouchRows);
+        BufferPool::instance().setReusePlacedBuffers(false);
+    }
+    if (options.count("pool-max-mb")) {
+        BufferPool::instance().setMaxCachedBytes(
+            std::stoull(options["pool-max-mb"]) << 20);
+    }
+    const bool poolStats = options.count("pool-stats");
+    const int deadlineMs = options.count("deadline-ms") ? 
+        std::stoi(options["deadline-ms"]) : 0;
+    SearchOptions searchOpts;
+    searchOpts.numaStats = options.count("numa-stats");
+    searchOpts.selection = (options["select"] == "best") ? SelectMode::Best :
+        SelectMode::First;
+    if (options.count("luminance")) {
+        const string& mode = options["luminance"];
+        searchOpts.luminance = (mode == "off") ? LumaMode::Off :
+            (mode == "on" || mode == "true") ? LumaMode::On : LumaMode::Auto;
+    }
+    if (options.count("score-map")) {
+        searchOpts.scoreMapFile   = options["score-map"];
+        searchOpts.scoreMapFormat = (options["score-format"] == "uint16") ?
+            ScoreMap::UInt16 : ScoreMap::Float32;
+    }
+    std::unique_ptr<ResultCache> cache;
+    try {
+        if (options.count("cache-dir")) {
+            const uint64_t maxMB = options.count("cache-max-mb") ? 
+                std::stoull(options["cache-max-mb"]) : 256;
+            cache.reset(new ResultCache(options["cache-dir"], maxMB << 20,
+                                        options["cache-images"] != "false"));
+            searchOpts.cache = cache.get();
+        }
+        if (options.count("threshold-map")) {
+            thresholdScoreMap(options["threshold-map"], args.size() > 1 ?
+                              std::stoi(args[1]) : 75, searchOpts.selection,
+                              args.size() > 3 ? args[2] : "", 
+                              args.size() > 3 ? args[3] : "");
+            return 0;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (options.count("batch")) {
+        const int status = runBatch(options["batch"], deadlineMs, searchOpts);
+        if (searchOpts.numaStats) {
+            printNumaStats();
+        }
+        if (poolStats) {
+            printPoolStats();
+        }
+        return status;
+    }
+
+    if (args.size() < 4) {
+        std::cout << "Usage: " << argv[0] << " [options] <MainPNGfile> "
+                  << "<SearchPNGfile> <OutputPNGfile> [isMaskFlag] "
+                  << "[match-percentage] [tolerance]\n"
+                  << "   or: " << argv[0] << " [options] --batch=<file>\n"
+                  << "   or: " << argv[0] << " --threshold-map=<file> "
+                  << "[match-percentage [MainPNGfile SearchPNGfile]]\n"
+                  << "Options: --threads=<n> --deadline-ms=<ms> "
+                  << "--luminance=auto|on|off --select=first|best\n"
+                  << "         --score-map=<file> --score-format=float|uint16\n"
+                  << "         --cache-dir=<dir> --cache-max-mb=<n> "
+                  << "--cache-images=true|false\n"
+                  << "         --numa --pin=none|compact|scatter "
+                  << "--numa-stats\n"
+                  << "         --pool-max-mb=<n> --pool-stats\n";
         return 1;
     }
     
     const std::string True("true");
-    imageSearch(argv[1], argv[2], argv[3],       // The 3 required PNG files
-                (argc > 4 ? (True == argv[4]) : true),   // Optional mask flag
-            (argc > 5 ? std::stoi(argv[5]) : 75),    // Optional percentMatch
-                (argc > 6 ? std::stoi(argv[6]) : 32));   // Optional tolerance
-
+    const SearchToken token(std::chrono::milliseconds{deadlineMs});
+    try {
+        imageSearch(args[1], args[2], args[3],     // The 3 required PNG files
+                    (args.size() > 4 ? (True == args[4]) : true),  // mask flag
+                    (args.size() > 5 ? std::stoi(args[5]) : 75), // percentMatch
+                    (args.size() > 6 ? std::stoi(args[6]) : 32), // tolerance
+                    searchOpts, token);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    if (searchOpts.numaStats) {
+        printNumaStats();
+    }
+    if (poolStats) {
+        printPoolStats();
+    }
     return 0;
 }
 